@@ -0,0 +1,127 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "async_writer.h"
+
+#include <chrono>
+#include <cstdio>
+
+async_point_cloud_writer::async_point_cloud_writer(size_t queue_capacity) :
+    m_queue_capacity(queue_capacity > 0 ? queue_capacity : 1)
+{
+    m_thread = std::thread(&async_point_cloud_writer::run, this);
+}
+
+async_point_cloud_writer::~async_point_cloud_writer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_queue_not_empty.notify_one();
+    m_thread.join();
+}
+
+void async_point_cloud_writer::submit(k4a_image_t point_cloud_image,
+    k4a_image_t color_image,
+    const std::string& file_name,
+    ply_write_options_t options,
+    const ray_table_t* rays)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queue.size() >= m_queue_capacity)
+    {
+        m_stats.stalls++;
+        auto stall_start = std::chrono::steady_clock::now();
+        m_queue_not_full.wait(lock, [this] { return m_queue.size() < m_queue_capacity; });
+        m_stats.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - stall_start).count();
+    }
+
+    m_queue.push_back({ point_cloud_image, color_image, file_name, options, rays });
+    if (m_queue.size() > m_stats.max_queue_depth)
+    {
+        m_stats.max_queue_depth = m_queue.size();
+    }
+    lock.unlock();
+    m_queue_not_empty.notify_one();
+}
+
+bool async_point_cloud_writer::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+    bool succeeded = !m_write_failed;
+    m_write_failed = false;
+    return succeeded;
+}
+
+async_writer_stats_t async_point_cloud_writer::get_stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void async_point_cloud_writer::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_queue_not_empty.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+        if (m_queue.empty())
+        {
+            // only reached when stopping, everything queued has been written
+            break;
+        }
+
+        job_t job = m_queue.front();
+        m_queue.pop_front();
+        m_busy = true;
+        lock.unlock();
+        m_queue_not_full.notify_one();
+
+        bool succeeded;
+        if (job.rays != NULL)
+        {
+            succeeded = tranformation_helpers_write_depth_point_cloud(job.rays,
+                job.point_cloud_image,
+                job.color_image,
+                job.file_name.c_str(),
+                job.options);
+        }
+        else
+        {
+            succeeded = tranformation_helpers_write_point_cloud(job.point_cloud_image,
+                job.color_image,
+                job.file_name.c_str(),
+                job.options);
+        }
+        k4a_image_release(job.point_cloud_image);
+        k4a_image_release(job.color_image);
+
+        lock.lock();
+        m_busy = false;
+        if (succeeded)
+        {
+            m_stats.written++;
+        }
+        else
+        {
+            m_stats.failed++;
+            m_write_failed = true;
+        }
+        if (m_queue.empty())
+        {
+            m_idle.notify_all();
+        }
+    }
+}
+
+void print_async_writer_stats(const async_writer_stats_t& stats)
+{
+    printf("writer: %zu written, %zu failed, max queue depth %zu, %zu stalls (%.3f s waiting for storage)\n",
+        stats.written,
+        stats.failed,
+        stats.max_queue_depth,
+        stats.stalls,
+        stats.stall_seconds);
+}
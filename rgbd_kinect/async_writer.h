@@ -0,0 +1,71 @@
+#pragma once
+#include <k4a/k4a.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "transformation_helpers.h"
+
+struct async_writer_stats_t
+{
+    size_t written;         // point clouds written successfully
+    size_t failed;          // point clouds that could not be written
+    size_t max_queue_depth; // highest number of point clouds waiting at once
+    size_t stalls;          // submissions that had to wait for a free queue slot
+    double stall_seconds;   // total time producers spent waiting, storage is the bottleneck when this grows
+};
+
+// Writes point clouds on a background thread, so the next transformation can run while the previous cloud is being
+// flushed to disk. The queue is bounded to keep the number of full resolution buffers in flight under control.
+class async_point_cloud_writer
+{
+public:
+    explicit async_point_cloud_writer(size_t queue_capacity);
+
+    // Writes everything still queued before returning
+    ~async_point_cloud_writer();
+
+    // Queues a cloud for writing and takes over the caller's reference to both images, which are released once the
+    // file is written. Blocks while the queue is full. When rays is given, point_cloud_image is instead a depth image
+    // in the geometry of rays and the points are computed while writing (see
+    // tranformation_helpers_write_depth_point_cloud). The table must outlive the writer.
+    void submit(k4a_image_t point_cloud_image,
+        k4a_image_t color_image,
+        const std::string& file_name,
+        ply_write_options_t options,
+        const ray_table_t* rays = NULL);
+
+    // Waits until every submitted cloud has been written. Returns false if any write failed since the last flush.
+    bool flush();
+
+    async_writer_stats_t get_stats();
+
+private:
+    struct job_t
+    {
+        k4a_image_t point_cloud_image;
+        k4a_image_t color_image;
+        std::string file_name;
+        ply_write_options_t options;
+        const ray_table_t* rays;
+    };
+
+    void run();
+
+    size_t m_queue_capacity;
+    std::deque<job_t> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_queue_not_empty;
+    std::condition_variable m_queue_not_full;
+    std::condition_variable m_idle;
+    bool m_busy = false;
+    bool m_stopping = false;
+    bool m_write_failed = false;
+    async_writer_stats_t m_stats = {};
+    std::thread m_thread;
+};
+
+void print_async_writer_stats(const async_writer_stats_t& stats);
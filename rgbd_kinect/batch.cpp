@@ -0,0 +1,487 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "batch.h"
+#include "color_pyramid.h"
+#include "frame_pool.h"
+#include "jpeg_decoder.h"
+#include "ray_table.h"
+#include "recording_index.h"
+#include "transformation_cache.h"
+#include "work_stealing_pool.h"
+
+#include <k4arecord/playback.h>
+#include <turbojpeg.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+// Recording time covered by one task, about 30 frames at the usual frame rates. Short enough that the last tasks of
+// a batch still spread over every thread, long enough that opening and seeking the recording for each task is noise.
+static const uint64_t BATCH_CHUNK_USEC = 1000000;
+
+struct batch_recording_t
+{
+    std::string path;
+    std::string name;              // recording file name without extension, made unique within the batch
+    std::string output_prefix;     // output directory and name, each file adds the position of its capture
+    bool valid;
+    uint64_t start_offset_usec;    // device timestamp of the start of the recording
+    uint64_t length_usec;
+    uint64_t first_usec;           // position of the first capture to convert
+    int decode_width;
+    int decode_height;
+    k4a_calibration_t calibration; // scaled to the decoded color images
+    size_t calibration_index;      // into the distinct calibrations of the batch
+};
+
+// A span of one recording, in microseconds from its start. A capture belongs to the chunk its depth timestamp falls
+// into, so neighbouring chunks never convert the same capture twice.
+struct batch_chunk_t
+{
+    size_t recording;
+    uint64_t begin_usec;
+    uint64_t end_usec;
+};
+
+// What each pool slot creates once and reuses for every chunk it runs. Its transformation handles come from the
+// transformation cache, under the same slot.
+struct batch_slot_t
+{
+    tjhandle decompressor;
+};
+
+struct batch_t
+{
+    std::vector<batch_recording_t> recordings;
+    std::vector<k4a_calibration_t> calibrations;
+    std::vector<ray_table_t> ray_tables;
+    std::vector<const ray_table_t*> rays; // per calibration, NULL where the SDK computes the points
+    std::vector<batch_slot_t> slots;
+    frame_buffer_pool frame_pool;
+    ply_write_options_t ply_options;
+    std::atomic<size_t> written{ 0 };
+    std::atomic<size_t> failed{ 0 };
+};
+
+static bool has_wildcard(const std::string& text)
+{
+    return text.find_first_of("*?") != std::string::npos;
+}
+
+// Matches name against a pattern in which * stands for any run of characters and ? for any one character
+static bool wildcard_match(const char* pattern, const char* name)
+{
+    const char* star = NULL;
+    const char* resume = NULL;
+    while (*name != '\0')
+    {
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            resume = name;
+        }
+        else if (*pattern == '?' || *pattern == *name)
+        {
+            pattern++;
+            name++;
+        }
+        else if (star != NULL)
+        {
+            // let the last star swallow one more character and try again
+            pattern = star + 1;
+            name = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+bool batch_list_recordings(const std::string& input, std::vector<std::string>* recordings)
+{
+    recordings->clear();
+    std::filesystem::path input_path(input);
+    if (has_wildcard(input_path.filename().string()))
+    {
+        std::filesystem::path directory = input_path.parent_path();
+        if (directory.empty())
+        {
+            directory = ".";
+        }
+        std::string pattern = input_path.filename().string();
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            if (entry.is_regular_file() && wildcard_match(pattern.c_str(), entry.path().filename().string().c_str()))
+            {
+                recordings->push_back(entry.path().string());
+            }
+        }
+        if (error)
+        {
+            printf("failed to list %s\n", directory.string().c_str());
+            return false;
+        }
+    }
+    else
+    {
+        std::ifstream list(input);
+        if (!list)
+        {
+            printf("failed to open recording list %s\n", input.c_str());
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            // tolerate Windows line endings and surrounding blanks
+            size_t first = line.find_first_not_of(" \t\r");
+            size_t last = line.find_last_not_of(" \t\r");
+            if (first != std::string::npos)
+            {
+                recordings->push_back(line.substr(first, last - first + 1));
+            }
+        }
+    }
+
+    std::sort(recordings->begin(), recordings->end());
+    if (recordings->empty())
+    {
+        printf("no recordings match %s\n", input.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reads what planning needs from the recording, the handle is only open while doing so
+static bool batch_open_recording(batch_recording_t* recording, int decode_scale, bool find_start)
+{
+    k4a_playback_t playback = NULL;
+    if (k4a_playback_open(recording->path.c_str(), &playback) != K4A_RESULT_SUCCEEDED || playback == NULL)
+    {
+        printf("failed to open recording %s\n", recording->path.c_str());
+        return false;
+    }
+
+    bool succeeded = false;
+    k4a_record_configuration_t record_configuration;
+    k4a_calibration_t calibration;
+    int color_width = 0;
+    int color_height = 0;
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_get_record_configuration(playback, &record_configuration) ||
+        K4A_RESULT_SUCCEEDED != k4a_playback_get_calibration(playback, &calibration))
+    {
+        printf("failed to get calibration of %s\n", recording->path.c_str());
+        goto exit;
+    }
+    if (record_configuration.color_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+    {
+        printf("color format of %s not supported. please use mjpeg\n", recording->path.c_str());
+        goto exit;
+    }
+
+    color_width = calibration.color_camera_calibration.resolution_width;
+    color_height = calibration.color_camera_calibration.resolution_height;
+    if (!jpeg_scale_supported(color_width, color_height, decode_scale))
+    {
+        printf("decoding %dx%d color frames of %s at 1/%d scale is not supported\n",
+            color_width,
+            color_height,
+            recording->path.c_str(),
+            decode_scale);
+        goto exit;
+    }
+
+    recording->start_offset_usec = record_configuration.start_timestamp_offset_usec;
+    recording->length_usec = k4a_playback_get_recording_length_usec(playback);
+    // a recording without a complete capture still counts as converted, it just has no chunks
+    recording->first_usec = 0;
+    if (find_start && !recording_find_first_complete(playback, &recording->first_usec))
+    {
+        printf("%s has no capture with both a depth and a color image\n", recording->path.c_str());
+        recording->first_usec = recording->length_usec + 1;
+    }
+    recording->decode_width = color_width / decode_scale;
+    recording->decode_height = color_height / decode_scale;
+    calibration_scale_color(&calibration, decode_scale, &recording->calibration);
+    succeeded = true;
+
+exit:
+    k4a_playback_close(playback);
+    return succeeded;
+}
+
+// Assigning into the same file_name for every capture of a chunk reuses its buffer
+static void batch_file_name(const batch_recording_t& recording, uint64_t position_usec, std::string* file_name)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%08llu.ply", (unsigned long long)(position_usec / 1000));
+    file_name->assign(recording.output_prefix);
+    file_name->append(suffix);
+}
+
+// Converts the captures of one chunk with the decompressor and transformation handles of slot
+static void batch_convert_chunk(batch_t* batch, const batch_chunk_t& chunk, size_t slot)
+{
+    const batch_recording_t& recording = batch->recordings[chunk.recording];
+    k4a_transformation_t transformation = transformation_cache_get(&recording.calibration, slot);
+    tjhandle decompressor = batch->slots[slot].decompressor;
+    const ray_table_t* rays = batch->rays[recording.calibration_index];
+    if (transformation == NULL || decompressor == NULL)
+    {
+        batch->failed++;
+        return;
+    }
+
+    // every task opens the recording itself, playback handles cannot be shared between threads
+    k4a_playback_t playback = NULL;
+    if (k4a_playback_open(recording.path.c_str(), &playback) != K4A_RESULT_SUCCEEDED || playback == NULL)
+    {
+        printf("failed to open recording %s\n", recording.path.c_str());
+        batch->failed++;
+        return;
+    }
+    if (k4a_playback_seek_timestamp(playback, (int64_t)chunk.begin_usec, K4A_PLAYBACK_SEEK_BEGIN) !=
+        K4A_RESULT_SUCCEEDED)
+    {
+        printf("failed to seek %s to %llu us\n", recording.path.c_str(), (unsigned long long)chunk.begin_usec);
+        k4a_playback_close(playback);
+        batch->failed++;
+        return;
+    }
+
+    std::string file_name;
+    for (;;)
+    {
+        k4a_capture_t capture = NULL;
+        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(playback, &capture);
+        if (stream_result == K4A_STREAM_RESULT_EOF)
+        {
+            break;
+        }
+        if (stream_result != K4A_STREAM_RESULT_SUCCEEDED || capture == NULL)
+        {
+            printf("Failed to read capture from %s\n", recording.path.c_str());
+            batch->failed++;
+            break;
+        }
+
+        image_handle depth_image(k4a_capture_get_depth_image(capture));
+        image_handle compressed_image(k4a_capture_get_color_image(capture));
+        k4a_capture_release(capture);
+        if (depth_image.get() == NULL || compressed_image.get() == NULL)
+        {
+            continue;
+        }
+
+        // the seek lands on the first capture with any image at or after the chunk start, which may still belong to
+        // the chunk before by its depth timestamp
+        uint64_t timestamp_usec = k4a_image_get_device_timestamp_usec(depth_image.get());
+        uint64_t position_usec =
+            timestamp_usec > recording.start_offset_usec ? timestamp_usec - recording.start_offset_usec : 0;
+        if (position_usec < chunk.begin_usec)
+        {
+            continue;
+        }
+        if (position_usec >= chunk.end_usec)
+        {
+            break;
+        }
+
+        image_handle color_image(batch->frame_pool.create_image(K4A_IMAGE_FORMAT_COLOR_BGRA32,
+            recording.decode_width,
+            recording.decode_height,
+            recording.decode_width * 4 * (int)sizeof(uint8_t)));
+        if (color_image.get() == NULL || !jpeg_decode_into(decompressor, compressed_image.get(), color_image.get()))
+        {
+            // undecodable frames are dropped like in playback
+            continue;
+        }
+        compressed_image.reset();
+
+        // with rays the points are computed from the transformed depth image while the file is written
+        batch_file_name(recording, position_usec, &file_name);
+        bool succeeded = false;
+        image_handle transformed_depth(frame_pool_transform_depth(&batch->frame_pool,
+            transformation,
+            depth_image.get(),
+            recording.decode_width,
+            recording.decode_height));
+        if (transformed_depth.get() != NULL && rays != NULL)
+        {
+            succeeded = tranformation_helpers_write_depth_point_cloud(rays,
+                transformed_depth.get(),
+                color_image.get(),
+                file_name.c_str(),
+                batch->ply_options);
+        }
+        else if (transformed_depth.get() != NULL)
+        {
+            image_handle points(frame_pool_point_cloud(&batch->frame_pool,
+                transformation,
+                transformed_depth.get(),
+                K4A_CALIBRATION_TYPE_COLOR));
+            succeeded = points.get() != NULL && tranformation_helpers_write_point_cloud(points.get(),
+                                                    color_image.get(),
+                                                    file_name.c_str(),
+                                                    batch->ply_options);
+        }
+
+        if (succeeded)
+        {
+            batch->written++;
+        }
+        else
+        {
+            printf("failed to convert %s\n", file_name.c_str());
+            batch->failed++;
+        }
+    }
+    k4a_playback_close(playback);
+}
+
+bool batch_convert(const std::vector<std::string>& recordings,
+    const std::string& output_dir,
+    ply_write_options_t ply_options,
+    const batch_options_t& options,
+    work_stealing_pool* pool)
+{
+    auto start = std::chrono::steady_clock::now();
+    batch_t batch;
+    batch.ply_options = ply_options;
+    batch.ply_options.pool = pool;
+
+    // Output files are named after their recording, recordings of the same name in different directories get the
+    // position in the list appended
+    std::map<std::string, size_t> name_counts;
+    batch.recordings.resize(recordings.size());
+    for (size_t i = 0; i < recordings.size(); i++)
+    {
+        batch_recording_t& recording = batch.recordings[i];
+        recording.path = recordings[i];
+        recording.name = std::filesystem::path(recordings[i]).stem().string();
+        if (name_counts[recording.name]++ > 0)
+        {
+            recording.name += "_" + std::to_string(i);
+        }
+        recording.output_prefix = (std::filesystem::path(output_dir) / recording.name).string();
+    }
+
+    // opening hundreds of recordings to read their calibration and scan for their first complete capture is itself
+    // worth spreading over the pool
+    pool->parallel_for(batch.recordings.size(), [&batch, &options](size_t task, size_t /*slot*/) {
+        batch.recordings[task].valid = batch_open_recording(&batch.recordings[task],
+            options.decode_scale,
+            options.find_start);
+    });
+
+    size_t failed_recordings = 0;
+    std::vector<batch_chunk_t> chunks;
+    std::map<k4a_transformation_t, size_t> calibration_indices;
+    for (size_t i = 0; i < batch.recordings.size(); i++)
+    {
+        batch_recording_t& recording = batch.recordings[i];
+        if (!recording.valid)
+        {
+            failed_recordings++;
+            continue;
+        }
+
+        // Recordings of one device share a calibration. The transformation cache tells equal calibrations apart and
+        // hands them the same handles, so its slot 0 handle identifies the calibration for sharing the ray table.
+        k4a_transformation_t transformation = transformation_cache_get(&recording.calibration);
+        if (transformation == NULL)
+        {
+            recording.valid = false;
+            failed_recordings++;
+            continue;
+        }
+        auto known = calibration_indices.find(transformation);
+        if (known == calibration_indices.end())
+        {
+            known = calibration_indices.insert({ transformation, batch.calibrations.size() }).first;
+            batch.calibrations.push_back(recording.calibration);
+        }
+        recording.calibration_index = known->second;
+
+        uint64_t begin_usec = std::max((uint64_t)options.start_ms * 1000, recording.first_usec);
+        // the last capture is at the recording length, the end is exclusive
+        uint64_t end_usec = recording.length_usec + 1;
+        if (options.end_ms > 0)
+        {
+            end_usec = std::min(end_usec, (uint64_t)options.end_ms * 1000);
+        }
+        for (uint64_t chunk_begin = begin_usec; chunk_begin < end_usec; chunk_begin += BATCH_CHUNK_USEC)
+        {
+            chunks.push_back({ i, chunk_begin, std::min(chunk_begin + BATCH_CHUNK_USEC, end_usec) });
+        }
+    }
+    printf("batch: %zu recordings, %zu distinct calibrations, %zu chunks on %zu threads\n",
+        batch.recordings.size() - failed_recordings,
+        batch.calibrations.size(),
+        chunks.size(),
+        pool->slot_count());
+
+    // ray tables are checked against the SDK once per calibration, not once per recording
+    batch.ray_tables.resize(batch.calibrations.size());
+    batch.rays.assign(batch.calibrations.size(), NULL);
+    for (size_t i = 0; i < batch.calibrations.size() && options.use_ray_tables; i++)
+    {
+        k4a_transformation_t transformation = transformation_cache_get(&batch.calibrations[i]);
+        if (transformation == NULL || !ray_table_create(&batch.calibrations[i], K4A_CALIBRATION_TYPE_COLOR,
+                                          &batch.ray_tables[i]))
+        {
+            continue;
+        }
+        if (!ray_table_validate(&batch.ray_tables[i], transformation, K4A_CALIBRATION_TYPE_COLOR))
+        {
+            printf("Ray table does not match the SDK, using the SDK point cloud instead\n");
+            ray_table_destroy(&batch.ray_tables[i]);
+            continue;
+        }
+        batch.rays[i] = &batch.ray_tables[i];
+    }
+
+    batch.slots.resize(pool->slot_count());
+    for (batch_slot_t& slot : batch.slots)
+    {
+        slot.decompressor = tjInitDecompress();
+    }
+
+    pool->parallel_for(chunks.size(), [&batch, &chunks](size_t task, size_t slot) {
+        batch_convert_chunk(&batch, chunks[task], slot);
+    });
+
+    for (batch_slot_t& slot : batch.slots)
+    {
+        if (slot.decompressor != NULL)
+        {
+            tjDestroy(slot.decompressor);
+        }
+    }
+    for (ray_table_t& table : batch.ray_tables)
+    {
+        ray_table_destroy(&table);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("batch: %zu point clouds written in %.3f s (%.1f fps), %zu failed, %zu recordings could not be opened\n",
+        batch.written.load(),
+        seconds,
+        seconds > 0 ? (double)batch.written.load() / seconds : 0,
+        batch.failed.load(),
+        failed_recordings);
+    return batch.failed.load() == 0 && failed_recordings == 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <k4a/k4a.h>
+
+#include <string>
+#include <vector>
+
+#include "transformation_helpers.h"
+
+class work_stealing_pool;
+
+// How batch mode converts each recording
+struct batch_options_t
+{
+    int start_ms;         // position in each recording of the first frame
+    int end_ms;           // frames from here on are left out, 0 converts to the end of each recording
+    int decode_scale;     // color frames are decoded at 1/decode_scale resolution
+    bool use_ray_tables;
+    bool find_start;      // start each recording at its first capture with both a depth and a color image
+};
+
+// Every frame of every recording from its first complete capture on, at full resolution
+static const batch_options_t BATCH_OPTIONS_INIT_DEFAULT = { 0, 0, 1, false, true };
+
+// Expands input into recording paths in sorted order. input is either a path whose file name contains the wildcards
+// * or ?, matched against the files of its directory, or a text file with one recording path per line. Returns false
+// if nothing could be listed.
+bool batch_list_recordings(const std::string& input, std::vector<std::string>* recordings);
+
+// Converts the frames of every recording into output_dir/<recording name>_<ms into the recording>.ply. Each recording
+// is split into chunks of about a second, and the chunks of all recordings are the tasks of one loop on pool, so a
+// few long recordings spread over every thread as well as many short ones. The PLY files are serialised on the same
+// pool through ply_options.pool. Recordings with identical calibrations share their transformation handles (one per
+// pool slot, as a handle is not thread-safe) and ray tables. Returns false if any recording or frame failed; the
+// others are still converted.
+bool batch_convert(const std::vector<std::string>& recordings,
+    const std::string& output_dir,
+    ply_write_options_t ply_options,
+    const batch_options_t& options,
+    work_stealing_pool* pool);
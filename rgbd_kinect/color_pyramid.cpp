@@ -0,0 +1,124 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "color_pyramid.h"
+#include "image_kernels.h"
+#include "transformation_cache.h"
+
+#include <cstdio>
+#include <cstring>
+
+void calibration_scale_color(const k4a_calibration_t* calibration, int divisor, k4a_calibration_t* scaled_calibration)
+{
+    memcpy(scaled_calibration, calibration, sizeof(k4a_calibration_t));
+    k4a_calibration_camera_t* color_camera = &scaled_calibration->color_camera_calibration;
+    color_camera->resolution_width /= divisor;
+    color_camera->resolution_height /= divisor;
+    color_camera->intrinsics.parameters.param.cx /= divisor;
+    color_camera->intrinsics.parameters.param.cy /= divisor;
+    color_camera->intrinsics.parameters.param.fx /= divisor;
+    color_camera->intrinsics.parameters.param.fy /= divisor;
+}
+
+bool color_pyramid_create(const k4a_calibration_t* calibration, int level_count, color_pyramid_t* pyramid)
+{
+    memset(pyramid, 0, sizeof(color_pyramid_t));
+    if (level_count < 1 || level_count > COLOR_PYRAMID_MAX_LEVELS)
+    {
+        printf("Unsupported number of pyramid levels %d\n", level_count);
+        return false;
+    }
+    pyramid->level_count = level_count;
+
+    for (int level = 0; level < level_count; level++)
+    {
+        calibration_scale_color(calibration, 1 << level, &pyramid->calibrations[level]);
+        pyramid->transformations[level] = transformation_cache_get(&pyramid->calibrations[level]);
+        if (pyramid->transformations[level] == NULL)
+        {
+            printf("Failed to create transformation for pyramid level %d\n", level);
+            color_pyramid_destroy(pyramid);
+            return false;
+        }
+
+        if (level == 0)
+        {
+            continue;
+        }
+        int width = pyramid->calibrations[level].color_camera_calibration.resolution_width;
+        int height = pyramid->calibrations[level].color_camera_calibration.resolution_height;
+        if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_COLOR_BGRA32,
+            width,
+            height,
+            width * 4 * (int)sizeof(uint8_t),
+            &pyramid->images[level]))
+        {
+            printf("Failed to create image for pyramid level %d\n", level);
+            color_pyramid_destroy(pyramid);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Computes row `row` of `level` from the two rows above it, and once that completes a pair of rows, carries on with
+// the next level down. Every row is consumed right after it is produced, while it is still in cache.
+static void build_row(color_pyramid_t* pyramid, int level, int row)
+{
+    k4a_image_t source = pyramid->images[level - 1];
+    k4a_image_t target = pyramid->images[level];
+    const uint8_t* source_data = k4a_image_get_buffer(source);
+    int source_stride_bytes = k4a_image_get_stride_bytes(source);
+
+    downscale_row_2x2_binning(source_data + (row * 2 + 0) * source_stride_bytes,
+        source_data + (row * 2 + 1) * source_stride_bytes,
+        k4a_image_get_width_pixels(target),
+        k4a_image_get_buffer(target) + row * k4a_image_get_stride_bytes(target));
+
+    if (level + 1 < pyramid->level_count && row % 2 == 1)
+    {
+        build_row(pyramid, level + 1, row / 2);
+    }
+}
+
+bool color_pyramid_build(color_pyramid_t* pyramid, k4a_image_t color_image)
+{
+    const k4a_calibration_camera_t* color_camera = &pyramid->calibrations[0].color_camera_calibration;
+    if (k4a_image_get_format(color_image) != K4A_IMAGE_FORMAT_COLOR_BGRA32 ||
+        k4a_image_get_width_pixels(color_image) != color_camera->resolution_width ||
+        k4a_image_get_height_pixels(color_image) != color_camera->resolution_height)
+    {
+        printf("Color image does not match the pyramid calibration\n");
+        return false;
+    }
+
+    if (pyramid->images[0] != NULL)
+    {
+        k4a_image_release(pyramid->images[0]);
+    }
+    k4a_image_reference(color_image);
+    pyramid->images[0] = color_image;
+
+    if (pyramid->level_count > 1)
+    {
+        int height = k4a_image_get_height_pixels(pyramid->images[1]);
+        for (int row = 0; row < height; row++)
+        {
+            build_row(pyramid, 1, row);
+        }
+    }
+    return true;
+}
+
+void color_pyramid_destroy(color_pyramid_t* pyramid)
+{
+    for (int level = 0; level < COLOR_PYRAMID_MAX_LEVELS; level++)
+    {
+        // the transformations belong to the transformation cache
+        if (pyramid->images[level] != NULL)
+        {
+            k4a_image_release(pyramid->images[level]);
+        }
+    }
+    memset(pyramid, 0, sizeof(color_pyramid_t));
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <k4a/k4a.h>
+
+// Full resolution plus the 1/2, 1/4 and 1/8 levels
+#define COLOR_PYRAMID_MAX_LEVELS 4
+
+// Copies calibration and scales the color camera to an image downscaled by divisor in both directions. The depth
+// camera and the extrinsics are left untouched, and the aspect ratio must stay the same so the distortion parameters
+// of the original calibration still apply.
+void calibration_scale_color(const k4a_calibration_t* calibration, int divisor, k4a_calibration_t* scaled_calibration);
+
+// BGRA color image pyramid where level n is 2^n times smaller than the full resolution image at level 0. The level
+// images, the matching calibrations and a transformation handle per level are set up once and reused for every
+// frame, so picking a cheaper level only costs the binning of the new frame. The handles come from the transformation
+// cache, pyramids of the same device share them.
+struct color_pyramid_t
+{
+    int level_count;
+    k4a_image_t images[COLOR_PYRAMID_MAX_LEVELS]; // level 0 references the source image of the last build
+    k4a_calibration_t calibrations[COLOR_PYRAMID_MAX_LEVELS];
+    k4a_transformation_t transformations[COLOR_PYRAMID_MAX_LEVELS];
+};
+
+// Prepares level_count levels (1 to COLOR_PYRAMID_MAX_LEVELS) for images matching the color camera of calibration
+bool color_pyramid_create(const k4a_calibration_t* calibration, int level_count, color_pyramid_t* pyramid);
+
+// Fills every level from a full resolution BGRA image in a single pass over it
+bool color_pyramid_build(color_pyramid_t* pyramid, k4a_image_t color_image);
+
+void color_pyramid_destroy(color_pyramid_t* pyramid);
@@ -0,0 +1,146 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "color_roi.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// Spacing of the interior depth pixels that are projected, the border of the depth image is projected in full
+#define COLOR_ROI_SAMPLE_STEP 4
+
+struct color_bounds_t
+{
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+};
+
+// Grows bounds by the color pixels depth pixel (u, v) projects into over the whole depth range
+static void add_depth_pixel(const k4a_calibration_t* calibration, float u, float v, color_bounds_t* bounds)
+{
+    static const float depths[] = { COLOR_ROI_MIN_DEPTH_MM, COLOR_ROI_MAX_DEPTH_MM };
+    const k4a_calibration_camera_t* color_camera = &calibration->color_camera_calibration;
+
+    for (float depth : depths)
+    {
+        k4a_float2_t depth_pixel;
+        depth_pixel.xy.x = u;
+        depth_pixel.xy.y = v;
+        k4a_float3_t color_point;
+        int valid = 0;
+        if (K4A_RESULT_SUCCEEDED != k4a_calibration_2d_to_3d(calibration,
+            &depth_pixel,
+            depth,
+            K4A_CALIBRATION_TYPE_DEPTH,
+            K4A_CALIBRATION_TYPE_COLOR,
+            &color_point,
+            &valid) ||
+            !valid)
+        {
+            // outside the lens model of the depth camera, such pixels never have depth
+            return;
+        }
+
+        k4a_float2_t color_pixel;
+        if (K4A_RESULT_SUCCEEDED != k4a_calibration_3d_to_2d(calibration,
+            &color_point,
+            K4A_CALIBRATION_TYPE_COLOR,
+            K4A_CALIBRATION_TYPE_COLOR,
+            &color_pixel,
+            &valid) ||
+            !valid)
+        {
+            // Outside the lens model of the color camera, which only happens well beyond the image. The pinhole
+            // projection still tells on which side, and the bounds are clamped to the image afterwards.
+            if (color_point.xyz.z <= 0.0f)
+            {
+                bounds->min_x = -FLT_MAX;
+                bounds->min_y = -FLT_MAX;
+                bounds->max_x = FLT_MAX;
+                bounds->max_y = FLT_MAX;
+                return;
+            }
+            const auto& param = color_camera->intrinsics.parameters.param;
+            color_pixel.xy.x = param.cx + param.fx * color_point.xyz.x / color_point.xyz.z;
+            color_pixel.xy.y = param.cy + param.fy * color_point.xyz.y / color_point.xyz.z;
+        }
+
+        bounds->min_x = std::min(bounds->min_x, color_pixel.xy.x);
+        bounds->min_y = std::min(bounds->min_y, color_pixel.xy.y);
+        bounds->max_x = std::max(bounds->max_x, color_pixel.xy.x);
+        bounds->max_y = std::max(bounds->max_y, color_pixel.xy.y);
+    }
+}
+
+bool color_roi_from_depth_frustum(const k4a_calibration_t* calibration, int alignment, color_roi_t* roi)
+{
+    int depth_width = calibration->depth_camera_calibration.resolution_width;
+    int depth_height = calibration->depth_camera_calibration.resolution_height;
+    int color_width = calibration->color_camera_calibration.resolution_width;
+    int color_height = calibration->color_camera_calibration.resolution_height;
+
+    color_bounds_t bounds = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int v = 0; v < depth_height; v++)
+    {
+        if (v == 0 || v == depth_height - 1)
+        {
+            for (int u = 0; u < depth_width; u++)
+            {
+                add_depth_pixel(calibration, (float)u, (float)v, &bounds);
+            }
+            continue;
+        }
+
+        add_depth_pixel(calibration, 0.0f, (float)v, &bounds);
+        add_depth_pixel(calibration, (float)(depth_width - 1), (float)v, &bounds);
+        if (v % COLOR_ROI_SAMPLE_STEP == 0)
+        {
+            for (int u = COLOR_ROI_SAMPLE_STEP; u < depth_width - 1; u += COLOR_ROI_SAMPLE_STEP)
+            {
+                add_depth_pixel(calibration, (float)u, (float)v, &bounds);
+            }
+        }
+    }
+    if (bounds.min_x > bounds.max_x)
+    {
+        return false;
+    }
+
+    // pixel centres sit on integer coordinates, keep every pixel the bounds touch plus the margin
+    int x_begin = (int)std::max(std::floor(bounds.min_x) - COLOR_ROI_MARGIN, 0.0f);
+    int y_begin = (int)std::max(std::floor(bounds.min_y) - COLOR_ROI_MARGIN, 0.0f);
+    int x_end = (int)std::min(std::ceil(bounds.max_x) + COLOR_ROI_MARGIN + 1, (float)color_width);
+    int y_end = (int)std::min(std::ceil(bounds.max_y) + COLOR_ROI_MARGIN + 1, (float)color_height);
+    if (x_begin >= x_end || y_begin >= y_end)
+    {
+        return false;
+    }
+
+    if (alignment > 1)
+    {
+        x_begin -= x_begin % alignment;
+        x_end = std::min((x_end + alignment - 1) / alignment * alignment, color_width);
+    }
+
+    roi->x = x_begin;
+    roi->y = y_begin;
+    roi->width = x_end - x_begin;
+    roi->height = y_end - y_begin;
+    return true;
+}
+
+void calibration_crop_color(const k4a_calibration_t* calibration,
+    const color_roi_t* roi,
+    k4a_calibration_t* cropped_calibration)
+{
+    memcpy(cropped_calibration, calibration, sizeof(k4a_calibration_t));
+    k4a_calibration_camera_t* color_camera = &cropped_calibration->color_camera_calibration;
+    color_camera->resolution_width = roi->width;
+    color_camera->resolution_height = roi->height;
+    color_camera->intrinsics.parameters.param.cx -= (float)roi->x;
+    color_camera->intrinsics.parameters.param.cy -= (float)roi->y;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <k4a/k4a.h>
+
+// Depth range used to bound the depth frustum. No depth mode reports points closer than 250 mm, and the far end is
+// the largest depth value, so every point the sensor can return lies in between.
+#define COLOR_ROI_MIN_DEPTH_MM 250.0f
+#define COLOR_ROI_MAX_DEPTH_MM 65535.0f
+
+// Extra color pixels kept around the projected frustum, covering the gaps between sampled depth pixels and the
+// footprint of a depth pixel once it is splatted into the color image
+#define COLOR_ROI_MARGIN 8
+
+// Rectangle of a color image in pixels
+struct color_roi_t
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Bounding box of every color pixel that a depth pixel can project into, computed once per calibration by projecting
+// the depth frustum at the near and far end of the depth range. Left and right edges are rounded outwards to
+// multiples of alignment, so a JPEG decoder can crop at MCU boundaries. Returns false if no depth pixel projects into
+// the color image.
+bool color_roi_from_depth_frustum(const k4a_calibration_t* calibration, int alignment, color_roi_t* roi);
+
+// Copies calibration and crops the color camera to roi, so a transformation made from it works on color images that
+// only hold the region. Projections are unchanged apart from the offset of the region.
+void calibration_crop_color(const k4a_calibration_t* calibration,
+    const color_roi_t* roi,
+    k4a_calibration_t* cropped_calibration);
@@ -0,0 +1,118 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "frame_pool.h"
+#include "point_cloud.h"
+
+#include <cstdio>
+
+frame_buffer_pool::~frame_buffer_pool()
+{
+    for (pooled_buffer_t* buffer : m_buffers)
+    {
+        aligned_buffer_free(buffer->data);
+        delete buffer;
+    }
+}
+
+k4a_image_t frame_buffer_pool::create_image(k4a_image_format_t format, int width, int height, int stride_bytes)
+{
+    buffer_key_t key((int)format, width, height, stride_bytes);
+    pooled_buffer_t* buffer = NULL;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<pooled_buffer_t*>& free_buffers = m_free_buffers[key];
+        if (!free_buffers.empty())
+        {
+            buffer = free_buffers.back();
+            free_buffers.pop_back();
+        }
+    }
+
+    if (buffer == NULL)
+    {
+        size_t size = (size_t)height * (size_t)stride_bytes;
+        uint8_t* data = (uint8_t*)aligned_buffer_allocate(size);
+        if (data == NULL)
+        {
+            printf("Failed to allocate pooled image buffer\n");
+            return NULL;
+        }
+        buffer = new pooled_buffer_t{ this, key, size, data };
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffers.push_back(buffer);
+        // reserving here keeps release_buffer from ever allocating
+        m_free_buffers[key].reserve(m_buffers.size());
+    }
+
+    k4a_image_t image = NULL;
+    if (K4A_RESULT_SUCCEEDED != k4a_image_create_from_buffer(format,
+        width,
+        height,
+        stride_bytes,
+        buffer->data,
+        buffer->size,
+        &frame_buffer_pool::release_buffer,
+        buffer,
+        &image))
+    {
+        printf("Failed to wrap pooled image buffer\n");
+        release_buffer(buffer->data, buffer);
+        return NULL;
+    }
+    return image;
+}
+
+void frame_buffer_pool::release_buffer(void* /*buffer*/, void* context)
+{
+    pooled_buffer_t* buffer = (pooled_buffer_t*)context;
+    frame_buffer_pool* pool = buffer->pool;
+    std::lock_guard<std::mutex> lock(pool->m_mutex);
+    pool->m_free_buffers[buffer->key].push_back(buffer);
+}
+
+k4a_image_t frame_pool_transform_depth(frame_buffer_pool* pool,
+    k4a_transformation_t transformation,
+    k4a_image_t depth_image,
+    int width,
+    int height)
+{
+    image_handle image(pool->create_image(K4A_IMAGE_FORMAT_DEPTH16, width, height, width * (int)sizeof(uint16_t)));
+    if (image.get() == NULL)
+    {
+        printf("Failed to create transformed depth image\n");
+        return NULL;
+    }
+
+    if (K4A_RESULT_SUCCEEDED !=
+        k4a_transformation_depth_image_to_color_camera(transformation, depth_image, image.get()))
+    {
+        printf("Failed to compute transformed depth image\n");
+        return NULL;
+    }
+    return image.release();
+}
+
+k4a_image_t frame_pool_point_cloud(frame_buffer_pool* pool,
+    k4a_transformation_t transformation,
+    k4a_image_t depth_image,
+    k4a_calibration_type_t camera)
+{
+    int width = k4a_image_get_width_pixels(depth_image);
+    int height = k4a_image_get_height_pixels(depth_image);
+    image_handle image(pool->create_image(K4A_IMAGE_FORMAT_CUSTOM, width, height, width * 3 * (int)sizeof(int16_t)));
+    if (image.get() == NULL)
+    {
+        printf("Failed to create point cloud image\n");
+        return NULL;
+    }
+
+    if (K4A_RESULT_SUCCEEDED !=
+        k4a_transformation_depth_image_to_point_cloud(transformation, depth_image, camera, image.get()))
+    {
+        printf("Failed to compute point cloud\n");
+        return NULL;
+    }
+    return image.release();
+}
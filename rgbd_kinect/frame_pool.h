@@ -0,0 +1,111 @@
+#pragma once
+#include <k4a/k4a.h>
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+// Owns one reference to a k4a image and releases it when it goes out of scope, so early returns cannot leak images
+class image_handle
+{
+public:
+    explicit image_handle(k4a_image_t image = NULL) : m_image(image)
+    {
+    }
+
+    ~image_handle()
+    {
+        reset();
+    }
+
+    image_handle(image_handle&& other) : m_image(other.release())
+    {
+    }
+
+    image_handle& operator=(image_handle&& other)
+    {
+        reset(other.release());
+        return *this;
+    }
+
+    image_handle(const image_handle&) = delete;
+    image_handle& operator=(const image_handle&) = delete;
+
+    k4a_image_t get() const
+    {
+        return m_image;
+    }
+
+    // Gives up ownership, for handing the reference to code that releases it itself
+    k4a_image_t release()
+    {
+        k4a_image_t image = m_image;
+        m_image = NULL;
+        return image;
+    }
+
+    void reset(k4a_image_t image = NULL)
+    {
+        if (m_image != NULL)
+        {
+            k4a_image_release(m_image);
+        }
+        m_image = image;
+    }
+
+private:
+    k4a_image_t m_image;
+};
+
+// Recycles the buffers of intermediate images. Every buffer is POINT_CLOUD_ALIGNMENT aligned and belongs to one
+// combination of format, size and stride; releasing the last reference to an image puts its buffer back on the free
+// list of that combination. Once every kind of image a frame needs has been created, processing further frames
+// allocates no image memory. Thread-safe, images may be released on any thread.
+class frame_buffer_pool
+{
+public:
+    frame_buffer_pool() = default;
+
+    // Every image created by the pool must have been released before it is destroyed
+    ~frame_buffer_pool();
+
+    frame_buffer_pool(const frame_buffer_pool&) = delete;
+    frame_buffer_pool& operator=(const frame_buffer_pool&) = delete;
+
+    // Image backed by a pooled buffer, NULL if no buffer could be allocated
+    k4a_image_t create_image(k4a_image_format_t format, int width, int height, int stride_bytes);
+
+private:
+    // format, width, height, stride in bytes
+    typedef std::tuple<int, int, int, int> buffer_key_t;
+
+    struct pooled_buffer_t
+    {
+        frame_buffer_pool* pool;
+        buffer_key_t key;
+        size_t size;
+        uint8_t* data;
+    };
+
+    static void release_buffer(void* buffer, void* context);
+
+    std::mutex m_mutex;
+    std::map<buffer_key_t, std::vector<pooled_buffer_t*>> m_free_buffers;
+    std::vector<pooled_buffer_t*> m_buffers;
+};
+
+// Depth image in the geometry of the color camera of transformation, width x height being the color resolution of its
+// calibration, in a buffer from pool. The caller owns the returned reference, NULL on failure.
+k4a_image_t frame_pool_transform_depth(frame_buffer_pool* pool,
+    k4a_transformation_t transformation,
+    k4a_image_t depth_image,
+    int width,
+    int height);
+
+// Point cloud of depth_image, which is in the geometry of camera, in a buffer from pool. The caller owns the returned
+// reference, NULL on failure.
+k4a_image_t frame_pool_point_cloud(frame_buffer_pool* pool,
+    k4a_transformation_t transformation,
+    k4a_image_t depth_image,
+    k4a_calibration_type_t camera);
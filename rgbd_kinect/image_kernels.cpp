@@ -0,0 +1,70 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "image_kernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_KERNELS_SSE2
+#endif
+
+void downscale_row_2x2_binning_scalar(const uint8_t* top_row,
+    const uint8_t* bottom_row,
+    int output_width,
+    uint8_t* output_row)
+{
+    for (int i = 0; i < output_width; i++)
+    {
+        for (int channel = 0; channel < 4; channel++)
+        {
+            output_row[4 * i + channel] = (uint8_t)((top_row[8 * i + channel] + top_row[8 * i + 4 + channel] +
+                                                       bottom_row[8 * i + channel] + bottom_row[8 * i + 4 + channel]) /
+                                                   4.0f);
+        }
+    }
+}
+
+#ifdef IMAGE_KERNELS_SSE2
+
+// Sums the 2x2 blocks of four input pixels of each row into two output pixels held as 16 bit channel sums
+static inline __m128i sum_2x2_blocks(__m128i top, __m128i bottom)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    // widen to 16 bits and add the rows: the low half holds the column sums of pixels 0 and 1, the high half of 2 and 3
+    __m128i columns_01 = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+    __m128i columns_23 = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+
+    // add the neighbouring columns, giving the channel sums of output pixel 0 followed by output pixel 1
+    __m128i left_columns = _mm_unpacklo_epi64(columns_01, columns_23);
+    __m128i right_columns = _mm_unpackhi_epi64(columns_01, columns_23);
+    return _mm_add_epi16(left_columns, right_columns);
+}
+
+void downscale_row_2x2_binning(const uint8_t* top_row, const uint8_t* bottom_row, int output_width, uint8_t* output_row)
+{
+    // Each iteration turns eight input pixels of both rows into four output pixels. The sum of four bytes is at most
+    // 1020, so the 16 bit lanes cannot overflow and shifting by two rounds down exactly like the float division did.
+    int i = 0;
+    for (; i + 4 <= output_width; i += 4)
+    {
+        const uint8_t* top = top_row + 8 * i;
+        const uint8_t* bottom = bottom_row + 8 * i;
+        __m128i sums_01 = sum_2x2_blocks(_mm_loadu_si128((const __m128i*)top),
+            _mm_loadu_si128((const __m128i*)bottom));
+        __m128i sums_23 = sum_2x2_blocks(_mm_loadu_si128((const __m128i*)(top + 16)),
+            _mm_loadu_si128((const __m128i*)(bottom + 16)));
+        __m128i averages = _mm_packus_epi16(_mm_srli_epi16(sums_01, 2), _mm_srli_epi16(sums_23, 2));
+        _mm_storeu_si128((__m128i*)(output_row + 4 * i), averages);
+    }
+    downscale_row_2x2_binning_scalar(top_row + 8 * i, bottom_row + 8 * i, output_width - i, output_row + 4 * i);
+}
+
+#else
+
+void downscale_row_2x2_binning(const uint8_t* top_row, const uint8_t* bottom_row, int output_width, uint8_t* output_row)
+{
+    downscale_row_2x2_binning_scalar(top_row, bottom_row, output_width, output_row);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Averages 2x2 blocks of BGRA pixels: output pixel i of the row is the mean of pixels 2i and 2i + 1 of the top and
+// bottom input rows, per channel and rounded down, which is what the original float implementation computed.
+// Uses SSE2 when the build targets it.
+void downscale_row_2x2_binning(const uint8_t* top_row,
+    const uint8_t* bottom_row,
+    int output_width,
+    uint8_t* output_row);
+
+// Plain C++ version of downscale_row_2x2_binning, used for the tail of a row and to validate the vectorised path
+void downscale_row_2x2_binning_scalar(const uint8_t* top_row,
+    const uint8_t* bottom_row,
+    int output_width,
+    uint8_t* output_row);
@@ -0,0 +1,383 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "jpeg_decoder.h"
+#include "point_cloud.h"
+#include "yuv_image.h"
+
+#include <csetjmp>
+#include <cstdio>
+
+// jpeglib.h relies on FILE and size_t being declared
+#include <jpeglib.h>
+
+bool jpeg_scale_supported(int width, int height, int divisor)
+{
+    int scaling_factor_count = 0;
+    tjscalingfactor* scaling_factors = tjGetScalingFactors(&scaling_factor_count);
+    for (int i = 0; i < scaling_factor_count; i++)
+    {
+        if (scaling_factors[i].num == 1 && scaling_factors[i].denom == divisor)
+        {
+            return TJSCALED(width, scaling_factors[i]) * divisor == width &&
+                   TJSCALED(height, scaling_factors[i]) * divisor == height;
+        }
+    }
+    return false;
+}
+
+bool jpeg_decode_into(tjhandle decompressor, const k4a_image_t compressed_image, k4a_image_t output_image)
+{
+    if (k4a_image_get_format(compressed_image) != K4A_IMAGE_FORMAT_COLOR_MJPG ||
+        k4a_image_get_format(output_image) != K4A_IMAGE_FORMAT_COLOR_BGRA32)
+    {
+        printf("Unsupported image format for jpeg decoding\n");
+        return false;
+    }
+
+    if (tjDecompress2(decompressor,
+        k4a_image_get_buffer(compressed_image),
+        static_cast<unsigned long>(k4a_image_get_size(compressed_image)),
+        k4a_image_get_buffer(output_image),
+        k4a_image_get_width_pixels(output_image),
+        k4a_image_get_stride_bytes(output_image),
+        k4a_image_get_height_pixels(output_image),
+        TJPF_BGRA,
+        TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) != 0)
+    {
+        printf("Failed to decompress color frame: %s\n", tjGetErrorStr2(decompressor));
+        return false;
+    }
+    return true;
+}
+
+static bool read_subsampling(tjhandle decompressor, const k4a_image_t compressed_image, int* subsampling)
+{
+    int width = 0;
+    int height = 0;
+    int colorspace = 0;
+    if (tjDecompressHeader3(decompressor,
+        k4a_image_get_buffer(compressed_image),
+        static_cast<unsigned long>(k4a_image_get_size(compressed_image)),
+        &width,
+        &height,
+        subsampling,
+        &colorspace) != 0)
+    {
+        printf("Failed to read color frame header: %s\n", tjGetErrorStr2(decompressor));
+        return false;
+    }
+    return true;
+}
+
+bool jpeg_decode_yuv_into(tjhandle decompressor, const k4a_image_t compressed_image, k4a_image_t output_image)
+{
+    int subsampling = 0;
+    if (!read_subsampling(decompressor, compressed_image, &subsampling))
+    {
+        return false;
+    }
+
+    int width = k4a_image_get_width_pixels(output_image);
+    int height = k4a_image_get_height_pixels(output_image);
+    if (k4a_image_get_format(output_image) != K4A_IMAGE_FORMAT_CUSTOM ||
+        tjBufSizeYUV2(width, 1, height, subsampling) != k4a_image_get_size(output_image))
+    {
+        printf("YUV image does not match the chroma subsampling of the color frame\n");
+        return false;
+    }
+
+    if (tjDecompressToYUV2(decompressor,
+        k4a_image_get_buffer(compressed_image),
+        static_cast<unsigned long>(k4a_image_get_size(compressed_image)),
+        k4a_image_get_buffer(output_image),
+        width,
+        1, // rows are not padded
+        height,
+        TJFLAG_FASTDCT) != 0)
+    {
+        printf("Failed to decompress color frame: %s\n", tjGetErrorStr2(decompressor));
+        return false;
+    }
+    return true;
+}
+
+// libjpeg reports errors through error_exit, which must not return
+struct jpeg_error_handler_t
+{
+    jpeg_error_mgr manager;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+struct jpeg_region_decoder_t
+{
+    jpeg_decompress_struct decompressor;
+    jpeg_error_handler_t error_handler;
+};
+
+static void jpeg_error_exit(j_common_ptr info)
+{
+    jpeg_error_handler_t* error_handler = (jpeg_error_handler_t*)info->err;
+    (*info->err->format_message)(info, error_handler->message);
+    longjmp(error_handler->jump, 1);
+}
+
+// Corrupt data warnings are not fatal and turbojpeg does not print them either
+static void jpeg_output_message(j_common_ptr)
+{
+}
+
+static jpeg_region_decoder_t* jpeg_region_decoder_create()
+{
+    jpeg_region_decoder_t* decoder = new jpeg_region_decoder_t;
+    decoder->decompressor.err = jpeg_std_error(&decoder->error_handler.manager);
+    decoder->error_handler.manager.error_exit = jpeg_error_exit;
+    decoder->error_handler.manager.output_message = jpeg_output_message;
+    if (setjmp(decoder->error_handler.jump))
+    {
+        printf("Failed to create jpeg decompressor: %s\n", decoder->error_handler.message);
+        delete decoder;
+        return NULL;
+    }
+    jpeg_create_decompress(&decoder->decompressor);
+    return decoder;
+}
+
+static void jpeg_region_decoder_destroy(jpeg_region_decoder_t* decoder)
+{
+    jpeg_destroy_decompress(&decoder->decompressor);
+    delete decoder;
+}
+
+// Decodes the crop of a frame scaled to frame_width into output_image. Columns outside the crop skip the IDCT and
+// color conversion, rows above it skip them as well and rows below it are not decoded at all. Settings match
+// jpeg_decode_into, so the pixels are the same as in a full decode.
+static bool jpeg_decode_region_into(jpeg_region_decoder_t* decoder,
+    const k4a_image_t compressed_image,
+    int frame_width,
+    const color_roi_t* crop,
+    k4a_image_t output_image)
+{
+    jpeg_decompress_struct* decompressor = &decoder->decompressor;
+    if (setjmp(decoder->error_handler.jump))
+    {
+        printf("Failed to decompress color frame: %s\n", decoder->error_handler.message);
+        jpeg_abort_decompress(decompressor);
+        return false;
+    }
+
+    jpeg_mem_src(decompressor,
+        k4a_image_get_buffer(compressed_image),
+        static_cast<unsigned long>(k4a_image_get_size(compressed_image)));
+    jpeg_read_header(decompressor, TRUE);
+    decompressor->out_color_space = JCS_EXT_BGRA;
+    decompressor->dct_method = JDCT_IFAST;
+    decompressor->do_fancy_upsampling = FALSE;
+    decompressor->scale_num = 1;
+    decompressor->scale_denom = decompressor->image_width / (unsigned int)frame_width;
+    jpeg_start_decompress(decompressor);
+
+    JDIMENSION crop_x = (JDIMENSION)crop->x;
+    JDIMENSION crop_width = (JDIMENSION)crop->width;
+    jpeg_crop_scanline(decompressor, &crop_x, &crop_width);
+    if (crop_x != (JDIMENSION)crop->x || crop_width != (JDIMENSION)crop->width)
+    {
+        printf("Crop region is not aligned to the MCUs of the color frame\n");
+        jpeg_abort_decompress(decompressor);
+        return false;
+    }
+
+    // fewer rows than asked for would leave part of the pooled output image holding an older frame
+    if (crop->y > 0 && jpeg_skip_scanlines(decompressor, (JDIMENSION)crop->y) != (JDIMENSION)crop->y)
+    {
+        printf("Color frame ended before the crop region\n");
+        jpeg_abort_decompress(decompressor);
+        return false;
+    }
+    uint8_t* row = k4a_image_get_buffer(output_image);
+    int stride_bytes = k4a_image_get_stride_bytes(output_image);
+    for (int y = 0; y < crop->height; y++)
+    {
+        JSAMPROW rows[1] = { row };
+        if (jpeg_read_scanlines(decompressor, rows, 1) != 1)
+        {
+            printf("Color frame ended after %d of %d rows of the crop region\n", y, crop->height);
+            jpeg_abort_decompress(decompressor);
+            return false;
+        }
+        row += stride_bytes;
+    }
+
+    // leaves the decompressor ready for the next frame without touching the rows below the crop
+    jpeg_abort_decompress(decompressor);
+    return true;
+}
+
+jpeg_decoder_pool::jpeg_decoder_pool(size_t worker_count,
+    int output_width,
+    int output_height,
+    size_t output_image_count,
+    jpeg_output_t output,
+    const color_roi_t* crop) :
+    m_output_width(output_width),
+    m_output_height(output_height),
+    m_output(output),
+    m_cropped(crop != NULL),
+    m_crop(crop != NULL ? *crop : color_roi_t{ 0, 0, output_width, output_height }),
+    m_valid(true)
+{
+    if (m_cropped && output != JPEG_OUTPUT_BGRA32)
+    {
+        printf("Cropped decoding only supports BGRA32 output\n");
+        m_valid = false;
+        return;
+    }
+
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        tjhandle decompressor = tjInitDecompress();
+        if (decompressor == NULL)
+        {
+            printf("Failed to create turbojpeg decompressor\n");
+            m_valid = false;
+            break;
+        }
+        m_decompressors.push_back(decompressor);
+
+        if (m_cropped)
+        {
+            jpeg_region_decoder_t* region_decoder = jpeg_region_decoder_create();
+            if (region_decoder == NULL)
+            {
+                m_valid = false;
+                break;
+            }
+            m_region_decoders.push_back(region_decoder);
+        }
+    }
+
+    // YUV images are largest without chroma subsampling
+    size_t buffer_size = output == JPEG_OUTPUT_YUV ? yuv_image_size(output_width, output_height, 0, 0)
+                                                   : (size_t)m_crop.width * (size_t)m_crop.height * 4;
+    for (size_t i = 0; i < output_image_count && m_valid; i++)
+    {
+        uint8_t* buffer = (uint8_t*)aligned_buffer_allocate(buffer_size);
+        if (buffer == NULL)
+        {
+            printf("Failed to allocate decode buffer\n");
+            m_valid = false;
+            break;
+        }
+        m_buffers.push_back(buffer);
+        m_free_buffers.push_back(buffer);
+    }
+}
+
+jpeg_decoder_pool::~jpeg_decoder_pool()
+{
+    for (tjhandle decompressor : m_decompressors)
+    {
+        if (tjDestroy(decompressor))
+        {
+            printf("Failed to destroy turbojpeg handle\n");
+        }
+    }
+    for (jpeg_region_decoder_t* region_decoder : m_region_decoders)
+    {
+        jpeg_region_decoder_destroy(region_decoder);
+    }
+    for (uint8_t* buffer : m_buffers)
+    {
+        aligned_buffer_free(buffer);
+    }
+}
+
+bool jpeg_decoder_pool::is_valid() const
+{
+    return m_valid;
+}
+
+k4a_image_t jpeg_decoder_pool::decode(size_t worker, const k4a_image_t compressed_image)
+{
+    tjhandle decompressor = m_decompressors[worker];
+    k4a_image_format_t format = K4A_IMAGE_FORMAT_COLOR_BGRA32;
+    int stride_bytes = m_crop.width * 4 * (int)sizeof(uint8_t);
+    size_t size = (size_t)m_crop.width * (size_t)m_crop.height * 4;
+    if (m_output == JPEG_OUTPUT_YUV)
+    {
+        // the layout of a YUV image follows the chroma subsampling of the frame
+        int subsampling = 0;
+        if (!read_subsampling(decompressor, compressed_image, &subsampling))
+        {
+            return NULL;
+        }
+        if (subsampling != TJSAMP_444 && subsampling != TJSAMP_422 && subsampling != TJSAMP_420)
+        {
+            printf("Chroma subsampling of the color frame is not supported for YUV output\n");
+            return NULL;
+        }
+        format = K4A_IMAGE_FORMAT_CUSTOM;
+        stride_bytes = m_output_width;
+        size = yuv_image_size(m_output_width,
+            m_output_height,
+            subsampling == TJSAMP_444 ? 0 : 1,
+            subsampling == TJSAMP_420 ? 1 : 0);
+    }
+
+    uint8_t* buffer = acquire_buffer();
+    k4a_image_t image = NULL;
+    if (K4A_RESULT_SUCCEEDED != k4a_image_create_from_buffer(format,
+        m_crop.width,
+        m_crop.height,
+        stride_bytes,
+        buffer,
+        size,
+        &jpeg_decoder_pool::release_buffer,
+        this,
+        &image))
+    {
+        printf("Failed to wrap decode buffer\n");
+        release_buffer(buffer, this);
+        return NULL;
+    }
+
+    bool decoded;
+    if (m_cropped)
+    {
+        decoded = jpeg_decode_region_into(m_region_decoders[worker], compressed_image, m_output_width, &m_crop, image);
+    }
+    else if (m_output == JPEG_OUTPUT_YUV)
+    {
+        decoded = jpeg_decode_yuv_into(decompressor, compressed_image, image);
+    }
+    else
+    {
+        decoded = jpeg_decode_into(decompressor, compressed_image, image);
+    }
+    if (!decoded)
+    {
+        k4a_image_release(image);
+        return NULL;
+    }
+    return image;
+}
+
+uint8_t* jpeg_decoder_pool::acquire_buffer()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_buffer_released.wait(lock, [this] { return !m_free_buffers.empty(); });
+    uint8_t* buffer = m_free_buffers.back();
+    m_free_buffers.pop_back();
+    return buffer;
+}
+
+void jpeg_decoder_pool::release_buffer(void* buffer, void* context)
+{
+    jpeg_decoder_pool* pool = (jpeg_decoder_pool*)context;
+    {
+        std::lock_guard<std::mutex> lock(pool->m_mutex);
+        pool->m_free_buffers.push_back((uint8_t*)buffer);
+    }
+    pool->m_buffer_released.notify_one();
+}
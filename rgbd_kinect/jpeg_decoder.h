@@ -0,0 +1,74 @@
+#pragma once
+#include <k4a/k4a.h>
+#include <turbojpeg.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "color_roi.h"
+
+// Pixel layout of decoded color images
+enum jpeg_output_t
+{
+    JPEG_OUTPUT_BGRA32 = 0,
+    JPEG_OUTPUT_YUV, // planar YUV in the JPEG's own chroma subsampling, see yuv_image.h
+};
+
+// Returns true if turbojpeg can decode a width x height image at exactly 1/divisor of its size in both directions
+bool jpeg_scale_supported(int width, int height, int divisor);
+
+// Decodes an MJPEG color image into an existing BGRA32 image. A smaller output image than the compressed one makes
+// turbojpeg scale in the IDCT, see jpeg_scale_supported.
+bool jpeg_decode_into(tjhandle decompressor, const k4a_image_t compressed_image, k4a_image_t output_image);
+
+// Same as jpeg_decode_into for a YUV output image, whose layout has to match the chroma subsampling of the JPEG.
+// Skips color conversion entirely, see point_cloud_extract_yuv.
+bool jpeg_decode_yuv_into(tjhandle decompressor, const k4a_image_t compressed_image, k4a_image_t output_image);
+
+// libjpeg decompressor that decodes only a region of each frame, defined in jpeg_decoder.cpp
+struct jpeg_region_decoder_t;
+
+// Decompressor handles for a fixed set of workers plus preallocated output buffers for images of one size, so
+// decoding a stream of frames never creates a handle or allocates an image buffer once the pool is set up.
+class jpeg_decoder_pool
+{
+public:
+    // output_width and output_height are the size of a whole decoded frame. With a crop region (in pixels of the
+    // decoded frame, left and right edges on MCU boundaries) only that part is decoded, through libjpeg-turbo's
+    // partial decoding, and the output images are the size of the region. Cropping needs BGRA32 output.
+    jpeg_decoder_pool(size_t worker_count,
+        int output_width,
+        int output_height,
+        size_t output_image_count,
+        jpeg_output_t output = JPEG_OUTPUT_BGRA32,
+        const color_roi_t* crop = NULL);
+
+    // Every image returned by decode must have been released before the pool is destroyed
+    ~jpeg_decoder_pool();
+
+    // False if a handle or a buffer could not be created
+    bool is_valid() const;
+
+    // Decodes with the handle of `worker` into one of the preallocated buffers, waiting for a buffer to be released
+    // if all are in use. Releasing the returned image with k4a_image_release returns its buffer to the pool. Returns
+    // NULL if decoding failed. A worker index must only be used by one thread at a time.
+    k4a_image_t decode(size_t worker, const k4a_image_t compressed_image);
+
+private:
+    uint8_t* acquire_buffer();
+    static void release_buffer(void* buffer, void* context);
+
+    int m_output_width;
+    int m_output_height;
+    jpeg_output_t m_output;
+    bool m_cropped;
+    color_roi_t m_crop;
+    bool m_valid;
+    std::vector<tjhandle> m_decompressors;
+    std::vector<jpeg_region_decoder_t*> m_region_decoders;
+    std::vector<uint8_t*> m_buffers;
+    std::vector<uint8_t*> m_free_buffers;
+    std::mutex m_mutex;
+    std::condition_variable m_buffer_released;
+};
@@ -3,133 +3,197 @@
 
 #include <k4a/k4a.h>
 #include <k4arecord/playback.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+#include "async_writer.h"
+#include "batch.h"
+#include "color_pyramid.h"
+#include "frame_pool.h"
+#include "playback_pipeline.h"
+#include "ray_table.h"
+#include "recording_index.h"
+#include "transformation_cache.h"
 #include "transformation_helpers.h"
+#include "work_stealing_pool.h"
 #include <turbojpeg.h>
 
+// Builds the ray table of camera and keeps it only if it reproduces the SDK point cloud, so a calibration the table
+// cannot represent falls back to the SDK instead of producing different output
+static ray_table_t* create_validated_ray_table(const k4a_calibration_t* calibration,
+    k4a_transformation_t transformation_handle,
+    k4a_calibration_type_t camera,
+    ray_table_t* table)
+{
+    if (!ray_table_create(calibration, camera, table))
+    {
+        return NULL;
+    }
+    if (!ray_table_validate(table, transformation_handle, camera))
+    {
+        printf("Ray table does not match the SDK, using the SDK point cloud instead\n");
+        ray_table_destroy(table);
+        return NULL;
+    }
+    return table;
+}
+
+// Writes the point cloud of a depth image in the geometry of camera with the colors of color_image. With the ray table
+// of the camera the points are computed tile by tile while the file is written, otherwise the SDK computes a point
+// cloud image first. Takes over the caller's reference to depth_image and color_image.
+static bool write_point_cloud(k4a_transformation_t transformation_handle,
+    k4a_image_t depth_image,
+    k4a_image_t color_image,
+    k4a_calibration_type_t camera,
+    std::string file_name,
+    ply_write_options_t ply_options,
+    frame_buffer_pool* frame_pool,
+    async_point_cloud_writer* writer,
+    const ray_table_t* rays)
+{
+    image_handle depth(depth_image);
+    image_handle color(color_image);
+    if (rays != NULL)
+    {
+        if (writer != NULL)
+        {
+            // the writer releases both images once the file is on disk
+            writer->submit(depth.release(), color.release(), file_name, ply_options, rays);
+            return true;
+        }
+        return tranformation_helpers_write_depth_point_cloud(rays,
+            depth.get(),
+            color.get(),
+            file_name.c_str(),
+            ply_options);
+    }
+
+    image_handle point_cloud_image(frame_pool_point_cloud(frame_pool, transformation_handle, depth.get(), camera));
+    if (point_cloud_image.get() == NULL)
+    {
+        return false;
+    }
+
+    // the depth image is not needed to write the point cloud, a pooled one goes back to the pool here
+    depth.reset();
+
+    if (writer != NULL)
+    {
+        writer->submit(point_cloud_image.release(), color.release(), file_name, ply_options);
+        return true;
+    }
+
+    return tranformation_helpers_write_point_cloud(point_cloud_image.get(),
+        color.get(),
+        file_name.c_str(),
+        ply_options);
+}
+
 static bool point_cloud_color_to_depth(k4a_transformation_t transformation_handle,
     const k4a_image_t depth_image,
     const k4a_image_t color_image,
-    std::string file_name)
+    std::string file_name,
+    ply_write_options_t ply_options,
+    frame_buffer_pool* frame_pool,
+    async_point_cloud_writer* writer,
+    const ray_table_t* rays = NULL)
 {
     int depth_image_width_pixels = k4a_image_get_width_pixels(depth_image);
     int depth_image_height_pixels = k4a_image_get_height_pixels(depth_image);
-    k4a_image_t transformed_color_image = NULL;
-    if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_COLOR_BGRA32,
+    image_handle transformed_color_image(frame_pool->create_image(K4A_IMAGE_FORMAT_COLOR_BGRA32,
         depth_image_width_pixels,
         depth_image_height_pixels,
-        depth_image_width_pixels * 4 * (int)sizeof(uint8_t),
-        &transformed_color_image))
+        depth_image_width_pixels * 4 * (int)sizeof(uint8_t)));
+    if (transformed_color_image.get() == NULL)
     {
         printf("Failed to create transformed color image\n");
         return false;
     }
 
-    k4a_image_t point_cloud_image = NULL;
-    if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM,
-        depth_image_width_pixels,
-        depth_image_height_pixels,
-        depth_image_width_pixels * 3 * (int)sizeof(int16_t),
-        &point_cloud_image))
-    {
-        printf("Failed to create point cloud image\n");
-        return false;
-    }
-
     if (K4A_RESULT_SUCCEEDED != k4a_transformation_color_image_to_depth_camera(transformation_handle,
         depth_image,
         color_image,
-        transformed_color_image))
+        transformed_color_image.get()))
     {
         printf("Failed to compute transformed color image\n");
         return false;
     }
 
-    if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(transformation_handle,
+    // the depth image belongs to the caller, so the point cloud gets its own reference
+    k4a_image_reference(depth_image);
+    return write_point_cloud(transformation_handle,
         depth_image,
+        transformed_color_image.release(),
         K4A_CALIBRATION_TYPE_DEPTH,
-        point_cloud_image))
-    {
-        printf("Failed to compute point cloud\n");
-        return false;
-    }
-
-    tranformation_helpers_write_point_cloud(point_cloud_image, transformed_color_image, file_name.c_str());
-
-    k4a_image_release(transformed_color_image);
-    k4a_image_release(point_cloud_image);
-
-    return true;
+        file_name,
+        ply_options,
+        frame_pool,
+        writer,
+        rays);
 }
 
 static bool point_cloud_depth_to_color(k4a_transformation_t transformation_handle,
     const k4a_image_t depth_image,
     const k4a_image_t color_image,
-    std::string file_name)
+    std::string file_name,
+    ply_write_options_t ply_options,
+    frame_buffer_pool* frame_pool,
+    async_point_cloud_writer* writer,
+    const ray_table_t* rays = NULL)
 {
-    // transform color image into depth camera geometry
-    int color_image_width_pixels = k4a_image_get_width_pixels(color_image);
-    int color_image_height_pixels = k4a_image_get_height_pixels(color_image);
-    k4a_image_t transformed_depth_image = NULL;
-    if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16,
-        color_image_width_pixels,
-        color_image_height_pixels,
-        color_image_width_pixels * (int)sizeof(uint16_t),
-        &transformed_depth_image))
-    {
-        printf("Failed to create transformed depth image\n");
-        return false;
-    }
-
-    k4a_image_t point_cloud_image = NULL;
-    if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM,
-        color_image_width_pixels,
-        color_image_height_pixels,
-        color_image_width_pixels * 3 * (int)sizeof(int16_t),
-        &point_cloud_image))
-    {
-        printf("Failed to create point cloud image\n");
-        return false;
-    }
-
-    if (K4A_RESULT_SUCCEEDED !=
-        k4a_transformation_depth_image_to_color_camera(transformation_handle, depth_image, transformed_depth_image))
+    // transform depth image into color camera geometry
+    k4a_image_t transformed_depth_image = frame_pool_transform_depth(frame_pool,
+        transformation_handle,
+        depth_image,
+        k4a_image_get_width_pixels(color_image),
+        k4a_image_get_height_pixels(color_image));
+    if (transformed_depth_image == NULL)
     {
-        printf("Failed to compute transformed depth image\n");
         return false;
     }
 
-    if (K4A_RESULT_SUCCEEDED != k4a_transformation_depth_image_to_point_cloud(transformation_handle,
+    // the color image belongs to the caller, so the point cloud gets its own reference
+    k4a_image_reference(color_image);
+    return write_point_cloud(transformation_handle,
         transformed_depth_image,
+        color_image,
         K4A_CALIBRATION_TYPE_COLOR,
-        point_cloud_image))
-    {
-        printf("Failed to compute point cloud\n");
-        return false;
-    }
-
-    tranformation_helpers_write_point_cloud(point_cloud_image, color_image, file_name.c_str());
-
-    k4a_image_release(transformed_depth_image);
-    k4a_image_release(point_cloud_image);
-
-    return true;
+        file_name,
+        ply_options,
+        frame_pool,
+        writer,
+        rays);
 }
 
-static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT)
+static int capture(std::string output_dir,
+    uint8_t deviceId = K4A_DEVICE_DEFAULT,
+    ply_write_options_t ply_options = PLY_WRITE_OPTIONS_INIT_DEFAULT,
+    size_t writer_queue_depth = 0,
+    int color_level = 1,
+    bool use_ray_tables = false)
 {
     int returnCode = 1;
+    // declared before the writer so queued point clouds are written before their buffers go away
+    frame_buffer_pool frame_pool;
+    std::unique_ptr<async_point_cloud_writer> writer;
     k4a_device_t device = NULL;
     const int32_t TIMEOUT_IN_MS = 10000;
-    k4a_transformation_t transformation = NULL;
-    k4a_transformation_t transformation_color_downscaled = NULL;
+    color_pyramid_t color_pyramid = {};
     k4a_capture_t capture = NULL;
     std::string file_name = "";
     uint32_t device_count = 0;
     k4a_device_configuration_t config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
     k4a_image_t depth_image = NULL;
     k4a_image_t color_image = NULL;
-    k4a_image_t color_image_downscaled = NULL;
+    ray_table_t depth_ray_table = {};
+    ray_table_t color_ray_table = {};
+    ray_table_t downscaled_color_ray_table = {};
+    const ray_table_t* depth_rays = NULL;
+    const ray_table_t* color_rays = NULL;
+    const ray_table_t* downscaled_color_rays = NULL;
 
     device_count = k4a_device_get_installed_count();
 
@@ -159,7 +223,27 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
         goto Exit;
     }
 
-    transformation = k4a_transformation_create(&calibration);
+    // level 0 provides the full resolution transformation, the downscaled output uses color_level
+    if (!color_pyramid_create(&calibration, color_level + 1, &color_pyramid))
+    {
+        goto Exit;
+    }
+
+    if (use_ray_tables)
+    {
+        depth_rays = create_validated_ray_table(&color_pyramid.calibrations[0],
+            color_pyramid.transformations[0],
+            K4A_CALIBRATION_TYPE_DEPTH,
+            &depth_ray_table);
+        color_rays = create_validated_ray_table(&color_pyramid.calibrations[0],
+            color_pyramid.transformations[0],
+            K4A_CALIBRATION_TYPE_COLOR,
+            &color_ray_table);
+        downscaled_color_rays = create_validated_ray_table(&color_pyramid.calibrations[color_level],
+            color_pyramid.transformations[color_level],
+            K4A_CALIBRATION_TYPE_COLOR,
+            &downscaled_color_ray_table);
+    }
 
     if (K4A_RESULT_SUCCEEDED != k4a_device_start_cameras(device, &config))
     {
@@ -167,6 +251,11 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
         goto Exit;
     }
 
+    if (writer_queue_depth > 0)
+    {
+        writer.reset(new async_point_cloud_writer(writer_queue_depth));
+    }
+
     // Get a capture
     switch (k4a_device_get_capture(device, &capture, TIMEOUT_IN_MS))
     {
@@ -202,7 +291,14 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
 #else
     file_name = output_dir + "/color_to_depth.ply";
 #endif
-    if (point_cloud_color_to_depth(transformation, depth_image, color_image, file_name.c_str()) == false)
+    if (point_cloud_color_to_depth(color_pyramid.transformations[0],
+        depth_image,
+        color_image,
+        file_name.c_str(),
+        ply_options,
+        &frame_pool,
+        writer.get(),
+        depth_rays) == false)
     {
         goto Exit;
     }
@@ -213,7 +309,14 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
 #else
     file_name = output_dir + "/depth_to_color.ply";
 #endif
-    if (point_cloud_depth_to_color(transformation, depth_image, color_image, file_name.c_str()) == false)
+    if (point_cloud_depth_to_color(color_pyramid.transformations[0],
+        depth_image,
+        color_image,
+        file_name.c_str(),
+        ply_options,
+        &frame_pool,
+        writer.get(),
+        color_rays) == false)
     {
         goto Exit;
     }
@@ -221,23 +324,13 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
     // Compute color point cloud by warping depth image into color camera geometry with downscaled color image and
     // downscaled calibration. This example's goal is to show how to configure the calibration and use the
     // transformation API as it is when the user does not need a point cloud from high resolution transformed depth
-    // image. The downscaling method here is naively to average binning 2x2 pixels, user should choose their own
-    // appropriate downscale method on the color image, this example is only demonstrating the idea. However, no matter
-    // what scale you choose to downscale the color image, please keep the aspect ratio unchanged (to ensure the
-    // distortion parameters from original calibration can still be used for the downscaled image).
-    k4a_calibration_t calibration_color_downscaled;
-    memcpy(&calibration_color_downscaled, &calibration, sizeof(k4a_calibration_t));
-    calibration_color_downscaled.color_camera_calibration.resolution_width /= 2;
-    calibration_color_downscaled.color_camera_calibration.resolution_height /= 2;
-    calibration_color_downscaled.color_camera_calibration.intrinsics.parameters.param.cx /= 2;
-    calibration_color_downscaled.color_camera_calibration.intrinsics.parameters.param.cy /= 2;
-    calibration_color_downscaled.color_camera_calibration.intrinsics.parameters.param.fx /= 2;
-    calibration_color_downscaled.color_camera_calibration.intrinsics.parameters.param.fy /= 2;
-    transformation_color_downscaled = k4a_transformation_create(&calibration_color_downscaled);
-    color_image_downscaled = downscale_image_2x2_binning(color_image);
-    if (color_image_downscaled == 0)
-    {
-        printf("Failed to downscaled color image\n");
+    // image. The downscaling method here is naively to average binning 2x2 pixels per pyramid level, user should
+    // choose their own appropriate downscale method on the color image, this example is only demonstrating the idea.
+    // However, no matter what scale you choose to downscale the color image, please keep the aspect ratio unchanged
+    // (to ensure the distortion parameters from original calibration can still be used for the downscaled image).
+    if (!color_pyramid_build(&color_pyramid, color_image))
+    {
+        printf("Failed to downscale color image\n");
         goto Exit;
     }
 
@@ -246,10 +339,19 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
 #else
     file_name = output_dir + "/depth_to_color_downscaled.ply";
 #endif
-    if (point_cloud_depth_to_color(transformation_color_downscaled,
+    if (point_cloud_depth_to_color(color_pyramid.transformations[color_level],
         depth_image,
-        color_image_downscaled,
-        file_name.c_str()) == false)
+        color_pyramid.images[color_level],
+        file_name.c_str(),
+        ply_options,
+        &frame_pool,
+        writer.get(),
+        downscaled_color_rays) == false)
+    {
+        goto Exit;
+    }
+
+    if (writer != nullptr && !writer->flush())
     {
         goto Exit;
     }
@@ -257,6 +359,11 @@ static int capture(std::string output_dir, uint8_t deviceId = K4A_DEVICE_DEFAULT
     returnCode = 0;
 
 Exit:
+    if (writer != nullptr)
+    {
+        writer->flush();
+        print_async_writer_stats(writer->get_stats());
+    }
     if (depth_image != NULL)
     {
         k4a_image_release(depth_image);
@@ -269,14 +376,10 @@ Exit:
     {
         k4a_capture_release(capture);
     }
-    if (transformation != NULL)
-    {
-        k4a_transformation_destroy(transformation);
-    }
-    if (transformation_color_downscaled != NULL)
-    {
-        k4a_transformation_destroy(transformation_color_downscaled);
-    }
+    ray_table_destroy(&depth_ray_table);
+    ray_table_destroy(&color_ray_table);
+    ray_table_destroy(&downscaled_color_ray_table);
+    color_pyramid_destroy(&color_pyramid);
     if (device != NULL)
     {
         k4a_device_close(device);
@@ -284,24 +387,76 @@ Exit:
     return returnCode;
 }
 
-// Timestamp in milliseconds. Defaults to 1 sec as the first couple frames don't contain color
-static int playback(char* input_path, int timestamp = 20000, std::string output_filename = "output.ply")
+// How playback converts a recording
+struct playback_options_t
+{
+    int start_ms;              // position in the recording of the first frame
+    int end_ms;                // frames from here on are left out, 0 converts to the end of the recording
+    int stride;                // converts every stride-th frame
+    size_t writer_queue_depth; // point clouds waiting for the writer thread, 0 picks a default
+    int decode_scale;          // color frames are decoded at 1/decode_scale resolution
+    size_t decode_threads;
+    size_t transform_threads;
+    size_t read_queue_depth;   // captures waiting for a decode thread, 0 picks a default
+    size_t decode_queue_depth; // decoded frames waiting for a transform thread, 0 picks a default
+    jpeg_output_t decode_output;
+    bool crop_to_depth;        // decode only the color region the depth camera can see
+    bool use_ray_tables;
+    bool use_index;            // seek to the selected captures through the sidecar index of the recording
+    bool find_start;           // start at the first capture with both a depth and a color image, not at start_ms
+};
+
+// Every frame of the recording from the first complete capture on, decoded at full resolution with one thread per
+// pipeline stage
+static const playback_options_t PLAYBACK_OPTIONS_INIT_DEFAULT = {
+    0, 0, 1, 0, 1, 1, 1, 0, 0, JPEG_OUTPUT_BGRA32, false, false, false, true
+};
+
+// Sets file_name to output_filename with the frame number inserted before the extension, "cloud.ply" becomes
+// "cloud_000042.ply"
+static void numbered_file_name(const std::string& output_filename, size_t frame_number, std::string* file_name)
+{
+    size_t separator = output_filename.find_last_of("/\\");
+    size_t extension = output_filename.find_last_of('.');
+    if (extension == std::string::npos || (separator != std::string::npos && extension < separator))
+    {
+        extension = output_filename.size();
+    }
+    char number[32];
+    snprintf(number, sizeof(number), "_%06zu", frame_number);
+    file_name->assign(output_filename, 0, extension);
+    file_name->append(number);
+    file_name->append(output_filename, extension, std::string::npos);
+}
+
+// Timestamp in milliseconds. Defaults to the first capture with both images as the first couple frames don't contain
+// color
+static int playback(char* input_path,
+    std::string output_filename = "output.ply",
+    ply_write_options_t ply_options = PLY_WRITE_OPTIONS_INIT_DEFAULT,
+    const playback_options_t& options = PLAYBACK_OPTIONS_INIT_DEFAULT)
 {
     int returncode = 1;
+    std::unique_ptr<playback_pipeline> pipeline;
     k4a_playback_t playback = NULL;
+    k4a_record_configuration_t record_configuration;
     k4a_calibration_t calibration;
+    k4a_calibration_t scaled_calibration;
+    k4a_calibration_t color_calibration;
+    color_roi_t crop;
     k4a_transformation_t transformation = NULL;
-    k4a_capture_t capture = NULL;
-    k4a_image_t depth_image = NULL;
-    k4a_image_t color_image = NULL;
-    k4a_image_t uncompressed_color_image = NULL;
+    ray_table_t color_ray_table = {};
+    const ray_table_t* color_rays = NULL;
+    recording_index_t index = {};
+    std::unique_ptr<indexed_capture_reader> capture_reader;
+    playback_pipeline_config_t config = {};
+    playback_range_t range = PLAYBACK_RANGE_INIT_ALL;
+    uint64_t start_usec = (uint64_t)options.start_ms * 1000;
+    int color_width = 0;
+    int color_height = 0;
 
     k4a_result_t result;
-    k4a_stream_result_t stream_result;
 
-    std::string dir = "c:\\users\\tommas\\kinect_transformations\\\\";
-    std::string filename = "output.ply";
-    std::string out_file = dir + filename;
     // open recording
     result = k4a_playback_open(input_path, &playback);
     if (result != K4A_RESULT_SUCCEEDED || playback == NULL)
@@ -310,22 +465,33 @@ static int playback(char* input_path, int timestamp = 20000, std::string output_
         goto exit;
     }
 
-    result = k4a_playback_seek_timestamp(playback, 20000 * 1000, K4A_PLAYBACK_SEEK_BEGIN);
-    if (result != K4A_RESULT_SUCCEEDED)
+    if (options.use_index && !recording_index_open(input_path, playback, &index))
     {
-        printf("failed to seek timestamp %d\n", 20000);
         goto exit;
     }
-    printf("seeking to timestamp: %d/%d (ms)\n",
-        20000,
-        (int)(k4a_playback_get_recording_length_usec(playback) / 1000));
 
-    stream_result = k4a_playback_get_next_capture(playback, &capture);
-    if (stream_result != K4A_STREAM_RESULT_SUCCEEDED || capture == NULL)
+    // The first captures of a recording usually have no color image yet. Instead of skipping a fixed stretch of the
+    // recording to get past them, find the first capture with both images, from the index if there is one.
+    if (options.find_start)
+    {
+        bool found = options.use_index ? recording_index_first_complete(&index, &start_usec) :
+                                         recording_find_first_complete(playback, &start_usec);
+        if (!found)
+        {
+            printf("recording has no capture with both a depth and a color image\n");
+            goto exit;
+        }
+    }
+
+    result = k4a_playback_seek_timestamp(playback, (int64_t)start_usec, K4A_PLAYBACK_SEEK_BEGIN);
+    if (result != K4A_RESULT_SUCCEEDED)
     {
-        printf("failed to fetch frame\n");
+        printf("failed to seek timestamp %d\n", (int)(start_usec / 1000));
         goto exit;
     }
+    printf("seeking to timestamp: %d/%d (ms)\n",
+        (int)(start_usec / 1000),
+        (int)(k4a_playback_get_recording_length_usec(playback) / 1000));
 
     if (K4A_RESULT_SUCCEEDED != k4a_playback_get_calibration(playback, &calibration))
     {
@@ -333,118 +499,190 @@ static int playback(char* input_path, int timestamp = 20000, std::string output_
         goto exit;
     }
 
-    transformation = k4a_transformation_create(&calibration);
+    // When the color image is decoded at reduced scale, the transformation has to use a color calibration scaled the
+    // same way, exactly like the binned color image in capture()
+    calibration_scale_color(&calibration, options.decode_scale, &scaled_calibration);
+    color_calibration = scaled_calibration;
 
-    // fetch frame
-    depth_image = k4a_capture_get_depth_image(capture);
-    if (depth_image == 0)
+    // Only the part of the color image the depth frustum projects into can ever be sampled. Decoding just that crop
+    // and transforming with a calibration cropped the same way gives the same points for less work.
+    if (options.crop_to_depth)
     {
-        printf("failed to get depth image from capture\n");
-        goto exit;
+        // MCUs are at most 16 pixels wide, and shrink with the decode scale
+        if (!color_roi_from_depth_frustum(&scaled_calibration, std::max(16 / options.decode_scale, 1), &crop))
+        {
+            printf("depth camera does not overlap the color camera\n");
+            goto exit;
+        }
+        calibration_crop_color(&scaled_calibration, &crop, &color_calibration);
+        printf("decoding color region %dx%d at (%d, %d)\n", crop.width, crop.height, crop.x, crop.y);
+    }
+    if (options.use_ray_tables)
+    {
+        // only for checking the table, before the pipeline's first transform thread takes over slot 0
+        transformation = transformation_cache_get(&color_calibration);
+        if (transformation == NULL)
+        {
+            goto exit;
+        }
+        color_rays = create_validated_ray_table(&color_calibration,
+            transformation,
+            K4A_CALIBRATION_TYPE_COLOR,
+            &color_ray_table);
     }
 
-    color_image = k4a_capture_get_color_image(capture);
-    if (color_image == 0)
+    // convert color frames from mjpeg to bgra
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_get_record_configuration(playback, &record_configuration))
     {
-        printf("failed to get color image from capture\n");
+        printf("failed to get record configuration\n");
         goto exit;
     }
-
-    // convert color frame from mjpeg to bgra
-    k4a_image_format_t format;
-    format = k4a_image_get_format(color_image);
-    if (format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+    if (record_configuration.color_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
     {
         printf("color format not supported. please use mjpeg\n");
         goto exit;
     }
 
-    int color_width, color_height;
-    color_width = k4a_image_get_width_pixels(color_image);
-    color_height = k4a_image_get_height_pixels(color_image);
+    color_width = calibration.color_camera_calibration.resolution_width;
+    color_height = calibration.color_camera_calibration.resolution_height;
+    if (!jpeg_scale_supported(color_width, color_height, options.decode_scale))
+    {
+        printf("decoding %dx%d color frames at 1/%d scale is not supported\n",
+            color_width,
+            color_height,
+            options.decode_scale);
+        goto exit;
+    }
+
+    // Image timestamps count from the start of the device, recording positions from the start of the recording. The
+    // range applies to the depth image of each capture, with or without the index.
+    range.begin_timestamp_usec = record_configuration.start_timestamp_offset_usec + start_usec;
+    if (options.end_ms > 0)
+    {
+        range.end_timestamp_usec = record_configuration.start_timestamp_offset_usec + (uint64_t)options.end_ms * 1000;
+    }
+    range.stride = (size_t)std::max(options.stride, 1);
+
+    // With the index the range is applied to its entries up front, and the reader seeks from one selected capture to
+    // the next instead of reading the ones in between
+    if (options.use_index)
+    {
+        std::vector<size_t> selection = recording_index_select(&index,
+            start_usec,
+            (uint64_t)options.end_ms * 1000,
+            range.stride);
+        printf("index selects %zu of %zu captures\n", selection.size(), index.entries.size());
+        capture_reader.reset(new indexed_capture_reader(playback, &index, std::move(selection)));
+        range = PLAYBACK_RANGE_INIT_ALL;
+    }
 
-    if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_COLOR_BGRA32,
-        color_width,
-        color_height,
-        color_width * 4 * (int)sizeof(uint8_t),
-        &uncompressed_color_image))
+    // Every stage runs on its own threads, see playback_pipeline. The decoders, the transformation handles, the ray
+    // table and the pooled buffers are set up once here and reused for every frame.
+    config.decode_threads = options.decode_threads;
+    config.transform_threads = options.transform_threads;
+    config.read_queue_depth = options.read_queue_depth;
+    config.decode_queue_depth = options.decode_queue_depth;
+    config.write_queue_depth = options.writer_queue_depth;
+    config.decode_width = color_width / options.decode_scale;
+    config.decode_height = color_height / options.decode_scale;
+    config.decode_output = options.decode_output;
+    config.crop = options.crop_to_depth ? &crop : NULL;
+    config.calibration = &color_calibration;
+    config.rays = color_rays;
+    config.ply_options = ply_options;
+    config.range = range;
+    config.capture_reader = capture_reader.get();
+    config.file_name = [&output_filename](size_t frame_index, std::string* file_name) {
+        numbered_file_name(output_filename, frame_index, file_name);
+    };
+    pipeline.reset(new playback_pipeline(playback, config));
+    if (!pipeline->is_valid())
     {
-        printf("failed to create image buffer\n");
         goto exit;
     }
 
-    tjhandle tjhandle;
-    tjhandle = tjInitDecompress();
-    if (tjDecompress2(tjhandle,
-        k4a_image_get_buffer(color_image),
-        static_cast<unsigned long>(k4a_image_get_size(color_image)),
-        k4a_image_get_buffer(uncompressed_color_image),
-        color_width,
-        0, // pitch
-        color_height,
-        TJPF_BGRA,
-        TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) != 0)
+    // compute color point clouds by warping each depth image into color camera geometry
+    if (!pipeline->run())
     {
-        printf("failed to decompress color frame\n");
-        if (tjDestroy(tjhandle))
+        printf("failed to convert recording\n");
+        if (capture_reader != nullptr && capture_reader->is_stale())
         {
-            printf("failed to destroy turbojpeg handle\n");
+            // the size and modification time matched, but the contents did not, so the next run has to reindex
+            std::string index_path = recording_index_path(input_path);
+            if (remove(index_path.c_str()) == 0)
+            {
+                printf("%s is stale and was deleted, run again to rebuild it\n", index_path.c_str());
+            }
+            else
+            {
+                printf("%s is stale, delete it and run again to rebuild it\n", index_path.c_str());
+            }
         }
         goto exit;
     }
-    if (tjDestroy(tjhandle))
+    printf("converted %zu frames\n", pipeline->get_stats().written);
+    if (capture_reader != nullptr)
     {
-        printf("failed to destroy turbojpeg handle\n");
+        printf("index: %zu seeks, %zu captures read through\n",
+            capture_reader->seek_count(),
+            capture_reader->skipped_count());
     }
 
-    // compute color point cloud by warping depth image into color camera geometry
-    //works but wrong file type
-    if (point_cloud_depth_to_color(transformation, depth_image, uncompressed_color_image, out_file) == false)
+    returncode = 0;
+
+exit:
+    if (pipeline != nullptr)
     {
-        printf("failed to transform depth to color\n");
-        goto exit;
+        print_playback_pipeline_stats(pipeline->get_stats());
+        pipeline.reset();
     }
-    else
+    if (playback != NULL)
     {
-        printf("it worked\n");
-
+        k4a_playback_close(playback);
     }
+    ray_table_destroy(&color_ray_table);
+    return returncode;
+}
 
-   /* k4a_image_create(K4A_IMAGE_FORMAT_COLOR_BGRA32,
-        color_width,
-        color_height,
-        color_width * 4 * (int)sizeof(uint8_t),
-        &uncompressed_color_image);*/
-
-    //if (k4a_transformation_depth_image_to_color_camera(transformation, depth_image, uncompressed_color_image) == false)
-    //{
-    //    printf("failed to transform depth to color\n");
-    //    goto exit;
-    //}
-    //else
-    //{
-    //    printf("it worked\n");
-
-    //}
-
-   // if (k4a_transformation_depth_image_to_color_camera(transformation, depth_image, uncompressed_color_image) == false)
-   //{
-   //     printf("failed to transform depth to color\n");
-   //     goto exit;
-   // }
-   // else
-   // {
-   //     printf("it worked\n");
-
-   // }
+static int batch(char* input,
+    std::string output_dir,
+    ply_write_options_t ply_options,
+    const playback_options_t& options,
+    work_stealing_pool* pool)
+{
+    std::vector<std::string> recordings;
+    if (!batch_list_recordings(input, &recordings))
+    {
+        return 1;
+    }
 
+    // without a pool to share, the chunks run one after another on this thread
+    std::unique_ptr<work_stealing_pool> own_pool;
+    if (pool == NULL)
+    {
+        own_pool.reset(new work_stealing_pool(0));
+        pool = own_pool.get();
+    }
 
-    returncode = 0;
+    batch_options_t batch_options = BATCH_OPTIONS_INIT_DEFAULT;
+    batch_options.start_ms = options.start_ms;
+    batch_options.end_ms = options.end_ms;
+    batch_options.decode_scale = options.decode_scale;
+    batch_options.use_ray_tables = options.use_ray_tables;
+    batch_options.find_start = options.find_start;
+    return batch_convert(recordings, output_dir, ply_options, batch_options, pool) ? 0 : 1;
+}
 
-exit:
-    if (playback != NULL)
+// Depth timestamp of capture from the start of the recording if it has both a depth and a color image
+static bool complete_capture_position(k4a_capture_t capture, uint64_t start_offset_usec, uint64_t* position_usec)
+{
+    k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+    k4a_image_t color_image = k4a_capture_get_color_image(capture);
+    bool complete = depth_image != NULL && color_image != NULL;
+    if (complete)
     {
-        k4a_playback_close(playback);
+        uint64_t timestamp_usec = k4a_image_get_device_timestamp_usec(depth_image);
+        *position_usec = timestamp_usec > start_offset_usec ? timestamp_usec - start_offset_usec : 0;
     }
     if (depth_image != NULL)
     {
@@ -454,31 +692,374 @@ exit:
     {
         k4a_image_release(color_image);
     }
-    if (uncompressed_color_image != NULL)
+    return complete;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times the sparse extraction of one complete capture every interval_ms, the way a preview or a keyframe export reads
+// a recording, with three strategies: reading the whole recording and keeping the captures at the targets, seeking
+// to each target and reading until a complete capture turns up, and seeking straight to the indexed capture. Only
+// the demuxing is timed, nothing is decoded.
+static int benchmark(char* input_path, int interval_ms)
+{
+    int returncode = 1;
+    k4a_playback_t playback = NULL;
+    k4a_record_configuration_t record_configuration;
+    recording_index_t index = {};
+    std::vector<uint64_t> targets;
+    std::vector<size_t> selection;
+    uint64_t interval_usec = (uint64_t)std::max(interval_ms, 1) * 1000;
+    uint64_t length_usec = 0;
+    size_t sequential_count = 0;
+    size_t seek_count = 0;
+    size_t read_count = 0;
+    size_t indexed_count = 0;
+    double sequential_seconds = 0;
+    double seek_seconds = 0;
+    double index_seconds = 0;
+    double indexed_seconds = 0;
+    std::chrono::steady_clock::time_point start;
+
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_open(input_path, &playback) || playback == NULL)
     {
-        k4a_image_release(uncompressed_color_image);
+        printf("failed to open recording %s\n", input_path);
+        goto exit;
     }
-    if (capture != NULL)
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_get_record_configuration(playback, &record_configuration))
+    {
+        printf("failed to get record configuration\n");
+        goto exit;
+    }
+    length_usec = k4a_playback_get_recording_length_usec(playback);
+    for (uint64_t target = 0; target < length_usec; target += interval_usec)
     {
+        targets.push_back(target);
+    }
+
+    // read everything, keep the first complete capture at or after each target
+    start = std::chrono::steady_clock::now();
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_seek_timestamp(playback, 0, K4A_PLAYBACK_SEEK_BEGIN))
+    {
+        printf("failed to seek timestamp 0\n");
+        goto exit;
+    }
+    while (sequential_count < targets.size())
+    {
+        k4a_capture_t capture = NULL;
+        if (k4a_playback_get_next_capture(playback, &capture) != K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            break;
+        }
+        uint64_t position_usec = 0;
+        if (complete_capture_position(capture, record_configuration.start_timestamp_offset_usec, &position_usec))
+        {
+            // a gap in the recording longer than the interval passes several targets at once
+            while (sequential_count < targets.size() && targets[sequential_count] <= position_usec)
+            {
+                sequential_count++;
+            }
+        }
         k4a_capture_release(capture);
     }
-    if (transformation != NULL)
+    sequential_seconds = seconds_since(start);
+
+    // seek to each target, then read on until a complete capture
+    start = std::chrono::steady_clock::now();
+    for (uint64_t target : targets)
     {
-        k4a_transformation_destroy(transformation);
+        if (K4A_RESULT_SUCCEEDED != k4a_playback_seek_timestamp(playback, (int64_t)target, K4A_PLAYBACK_SEEK_BEGIN))
+        {
+            printf("failed to seek timestamp %llu (us)\n", (unsigned long long)target);
+            goto exit;
+        }
+        seek_count++;
+        k4a_capture_t capture = NULL;
+        while (k4a_playback_get_next_capture(playback, &capture) == K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            uint64_t position_usec = 0;
+            bool complete =
+                complete_capture_position(capture, record_configuration.start_timestamp_offset_usec, &position_usec);
+            k4a_capture_release(capture);
+            read_count++;
+            if (complete)
+            {
+                break;
+            }
+        }
+    }
+    seek_seconds = seconds_since(start);
+
+    // the first run builds the sidecar, later runs only load it
+    start = std::chrono::steady_clock::now();
+    if (!recording_index_open(input_path, playback, &index))
+    {
+        goto exit;
+    }
+    index_seconds = seconds_since(start);
+
+    // the first complete capture at or after each target, straight from the index
+    start = std::chrono::steady_clock::now();
+    {
+        const uint32_t complete = RECORDING_INDEX_HAS_COLOR | RECORDING_INDEX_HAS_DEPTH;
+        size_t entry = 0;
+        for (uint64_t target : targets)
+        {
+            while (entry < index.entries.size() &&
+                   ((index.entries[entry].flags & complete) != complete || index.entries[entry].position_usec < target))
+            {
+                entry++;
+            }
+            if (entry == index.entries.size())
+            {
+                break;
+            }
+            if (selection.empty() || selection.back() != entry)
+            {
+                selection.push_back(entry);
+            }
+        }
+        indexed_capture_reader reader(playback, &index, selection);
+        k4a_capture_t capture = NULL;
+        while (reader.next(&capture) == K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            indexed_count++;
+            k4a_capture_release(capture);
+        }
+        indexed_seconds = seconds_since(start);
+        if (reader.is_stale())
+        {
+            printf("%s is stale, delete it and run again to rebuild it\n", recording_index_path(input_path).c_str());
+            goto exit;
+        }
+        printf("%zu targets %d ms apart in %.1f s of recording\n",
+            targets.size(),
+            interval_ms,
+            (double)length_usec / 1000000);
+        printf("  sequential read : %8.1f ms, %zu captures\n", sequential_seconds * 1000, sequential_count);
+        printf("  seek and read on: %8.1f ms, %zu seeks, %zu captures read\n",
+            seek_seconds * 1000,
+            seek_count,
+            read_count);
+        printf("  indexed         : %8.1f ms, %zu captures, %zu seeks, %zu captures read through\n",
+            indexed_seconds * 1000,
+            indexed_count,
+            reader.seek_count(),
+            reader.skipped_count());
+        printf("  index open      : %8.1f ms, %zu entries in %s\n",
+            index_seconds * 1000,
+            index.entries.size(),
+            recording_index_path(input_path).c_str());
+    }
+
+    returncode = 0;
+
+exit:
+    if (playback != NULL)
+    {
+        k4a_playback_close(playback);
     }
     return returncode;
 }
 
 static void print_usage()
 {
-    printf("Usage: transformation_example capture <output_directory> [device_id]\n");
-    printf("Usage: transformation_example playback <filename.mkv> [timestamp (ms)] [output_file]\n");
+    printf("Usage: transformation_example capture <output_directory> [device_id] [options]\n");
+    printf("Usage: transformation_example playback <filename.mkv> [start timestamp (ms)] [output_file] [options]\n");
+    printf("       playback writes one output_file_NNNNNN.ply per frame, numbered from 0\n");
+    printf("Usage: transformation_example batch <recording list file | pattern like dir/*.mkv> <output_directory> "
+           "[options]\n");
+    printf("       batch writes <recording name>_<ms into the recording>.ply for every frame of every recording, "
+           "--start, --end, --decode-scale and --ray-table apply to each recording\n");
+    printf("Usage: transformation_example benchmark <filename.mkv> [interval (ms)]\n");
+    printf("       benchmark times reading one frame every interval (default 1000 ms) sequentially, by seeking, and "
+           "through the sidecar index\n");
+    printf("Options:\n");
+    printf("  --binary    write binary little-endian PLY files instead of ASCII\n");
+    printf("  --mmap      preallocate each PLY file and write it through a memory mapping\n");
+    printf("  --threads N number of threads generating and serialising each point cloud in bands of rows, 0 uses all "
+           "hardware threads (default 1, for batch all hardware threads)\n");
+    printf("  --writer-queue N  write PLY files on a background thread, buffering up to N point clouds (playback "
+           "always writes on its own thread, default 2)\n");
+    printf("  --color-level N   color pyramid level of the downscaled capture output, 1 = 1/2 (default), 2 = 1/4, "
+           "3 = 1/8\n");
+    printf("  --decode-scale N  decode playback color frames at 1/N resolution (1, 2, 4 or 8) and transform with a "
+           "matching calibration\n");
+    printf("  --decode-threads N  decode playback color frames on N threads, 0 uses all hardware threads "
+           "(default 1)\n");
+    printf("  --transform-threads N  transform playback frames on N threads with one transformation handle each, 0 "
+           "uses all hardware threads (default 1)\n");
+    printf("  --read-queue N    playback captures read ahead of the decode threads (default 2 per decode thread)\n");
+    printf("  --decode-queue N  decoded playback frames waiting for a transform thread (default 2 per transform "
+           "thread)\n");
+    printf("  --yuv       decode playback color frames to YUV and convert only the pixels that become points\n");
+    printf("  --ray-table compute points from per-pixel ray tables checked against the SDK once at startup, one tile "
+           "at a time while writing\n");
+    printf("  --min-depth N  leave out points closer than N mm\n");
+    printf("  --max-depth N  leave out points farther than N mm\n");
+    printf("  --crop      decode only the part of playback color frames the depth camera can see, not with --yuv\n");
+    printf("  --start MS  first frame at MS into the recording (default the first capture with depth and color)\n");
+    printf("  --end MS    convert playback frames before MS into the recording (default the whole recording)\n");
+    printf("  --stride N  convert every Nth playback frame (default 1)\n");
+    printf("  --index     seek to the playback frames through <filename.mkv>.k4aidx, built on first use\n");
 }
 
 int main(int argc, char** argv)
 {
     int returnCode = 0;
 
+    // Options may appear anywhere on the command line, strip them so the positional arguments keep their index
+    ply_write_options_t ply_options = PLY_WRITE_OPTIONS_INIT_DEFAULT;
+    size_t write_thread_count = 1;
+    size_t writer_queue_depth = 0;
+    int color_level = 1;
+    playback_options_t playback_options = PLAYBACK_OPTIONS_INIT_DEFAULT;
+    bool start_given = false;
+    bool threads_given = false;
+    bool use_ray_tables = false;
+    std::vector<char*> arguments;
+    for (int i = 0; i < argc; i++)
+    {
+        std::string argument = std::string(argv[i]);
+        if (argument == "--threads" && i + 1 < argc)
+        {
+            // 0 picks one thread per hardware thread
+            int thread_count = atoi(argv[++i]);
+            if (thread_count <= 0)
+            {
+                thread_count = (int)std::thread::hardware_concurrency();
+            }
+            write_thread_count = thread_count > 0 ? (size_t)thread_count : 1;
+            threads_given = true;
+        }
+        else if (argument == "--writer-queue" && i + 1 < argc)
+        {
+            int queue_depth = atoi(argv[++i]);
+            writer_queue_depth = queue_depth > 0 ? (size_t)queue_depth : 0;
+        }
+        else if (argument == "--color-level" && i + 1 < argc)
+        {
+            color_level = atoi(argv[++i]);
+            if (color_level < 1 || color_level >= COLOR_PYRAMID_MAX_LEVELS)
+            {
+                printf("--color-level must be between 1 and %d\n", COLOR_PYRAMID_MAX_LEVELS - 1);
+                return 1;
+            }
+        }
+        else if (argument == "--decode-scale" && i + 1 < argc)
+        {
+            int decode_scale = atoi(argv[++i]);
+            if (decode_scale != 1 && decode_scale != 2 && decode_scale != 4 && decode_scale != 8)
+            {
+                printf("--decode-scale must be 1, 2, 4 or 8\n");
+                return 1;
+            }
+            playback_options.decode_scale = decode_scale;
+        }
+        else if (argument == "--decode-threads" && i + 1 < argc)
+        {
+            int thread_count = atoi(argv[++i]);
+            if (thread_count <= 0)
+            {
+                thread_count = (int)std::thread::hardware_concurrency();
+            }
+            playback_options.decode_threads = thread_count > 0 ? (size_t)thread_count : 1;
+        }
+        else if (argument == "--transform-threads" && i + 1 < argc)
+        {
+            int thread_count = atoi(argv[++i]);
+            if (thread_count <= 0)
+            {
+                thread_count = (int)std::thread::hardware_concurrency();
+            }
+            playback_options.transform_threads = thread_count > 0 ? (size_t)thread_count : 1;
+        }
+        else if (argument == "--read-queue" && i + 1 < argc)
+        {
+            playback_options.read_queue_depth = (size_t)std::max(atoi(argv[++i]), 0);
+        }
+        else if (argument == "--decode-queue" && i + 1 < argc)
+        {
+            playback_options.decode_queue_depth = (size_t)std::max(atoi(argv[++i]), 0);
+        }
+        else if (argument == "--yuv")
+        {
+            playback_options.decode_output = JPEG_OUTPUT_YUV;
+        }
+        else if (argument == "--ray-table")
+        {
+            use_ray_tables = true;
+        }
+        else if (argument == "--crop")
+        {
+            playback_options.crop_to_depth = true;
+        }
+        else if (argument == "--start" && i + 1 < argc)
+        {
+            playback_options.start_ms = std::max(atoi(argv[++i]), 0);
+            start_given = true;
+        }
+        else if (argument == "--end" && i + 1 < argc)
+        {
+            playback_options.end_ms = std::max(atoi(argv[++i]), 0);
+        }
+        else if (argument == "--stride" && i + 1 < argc)
+        {
+            playback_options.stride = std::max(atoi(argv[++i]), 1);
+        }
+        else if (argument == "--index")
+        {
+            playback_options.use_index = true;
+        }
+        else if (argument == "--min-depth" && i + 1 < argc)
+        {
+            ply_options.min_depth_mm = std::max(atoi(argv[++i]), 0);
+        }
+        else if (argument == "--max-depth" && i + 1 < argc)
+        {
+            ply_options.max_depth_mm = std::max(atoi(argv[++i]), 0);
+        }
+        else if (argument == "--binary")
+        {
+            ply_options.format = PLY_FORMAT_BINARY_LITTLE_ENDIAN;
+        }
+        else if (argument == "--mmap")
+        {
+            ply_options.output = PLY_OUTPUT_MEMORY_MAPPED;
+        }
+        else
+        {
+            arguments.push_back(argv[i]);
+        }
+    }
+    if (playback_options.crop_to_depth && playback_options.decode_output == JPEG_OUTPUT_YUV)
+    {
+        printf("--crop and --yuv cannot be combined\n");
+        return 1;
+    }
+    argc = (int)arguments.size();
+    argv = arguments.data();
+    playback_options.writer_queue_depth = writer_queue_depth;
+    playback_options.use_ray_tables = use_ray_tables;
+    playback_options.find_start = !start_given;
+
+    // a batch has frames of many recordings to spread, so it takes every hardware thread unless told otherwise
+    if (!threads_given && argc >= 2 && std::string(argv[1]) == "batch")
+    {
+        write_thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // the calling thread serialises bands too, so one thread less is started
+    std::unique_ptr<work_stealing_pool> write_pool;
+    if (write_thread_count > 1)
+    {
+        write_pool.reset(new work_stealing_pool(write_thread_count - 1));
+        ply_options.pool = write_pool.get();
+    }
+
     if (argc < 2)
     {
         print_usage();
@@ -490,11 +1071,17 @@ int main(int argc, char** argv)
         {
             if (argc == 3)
             {
-                returnCode = capture(argv[2]);
+                returnCode =
+                    capture(argv[2], K4A_DEVICE_DEFAULT, ply_options, writer_queue_depth, color_level, use_ray_tables);
             }
             else if (argc == 4)
             {
-                returnCode = capture(argv[2], (uint8_t)atoi(argv[3]));
+                returnCode = capture(argv[2],
+                    (uint8_t)atoi(argv[3]),
+                    ply_options,
+                    writer_queue_depth,
+                    color_level,
+                    use_ray_tables);
             }
             else
             {
@@ -503,17 +1090,41 @@ int main(int argc, char** argv)
         }
         else if (mode == "playback")
         {
-            if (argc == 3)
+            // the positional timestamp is the start of the range unless --start gives it
+            if (argc >= 4 && !start_given)
             {
-                returnCode = playback(argv[2]);
+                playback_options.start_ms = std::max(atoi(argv[3]), 0);
+                playback_options.find_start = false;
             }
-            else if (argc == 4)
+            if (argc == 3 || argc == 4)
             {
-                returnCode = playback(argv[2], atoi(argv[3]));
+                returnCode = playback(argv[2], "output.ply", ply_options, playback_options);
             }
             else if (argc == 5)
             {
-                returnCode = playback(argv[2], atoi(argv[3]), argv[4]);
+                returnCode = playback(argv[2], argv[4], ply_options, playback_options);
+            }
+            else
+            {
+                print_usage();
+            }
+        }
+        else if (mode == "batch")
+        {
+            if (argc == 4)
+            {
+                returnCode = batch(argv[2], argv[3], ply_options, playback_options, write_pool.get());
+            }
+            else
+            {
+                print_usage();
+            }
+        }
+        else if (mode == "benchmark")
+        {
+            if (argc == 3 || argc == 4)
+            {
+                returnCode = benchmark(argv[2], argc == 4 ? atoi(argv[3]) : 1000);
             }
             else
             {
@@ -526,5 +1137,7 @@ int main(int argc, char** argv)
         }
     }
 
+    // every capture, playback and batch has finished with its transformations by now
+    transformation_cache_clear();
     return returnCode;
 }
\ No newline at end of file
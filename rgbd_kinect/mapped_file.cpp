@@ -0,0 +1,275 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool mapped_file_create(const char* file_name, size_t size, mapped_file_t* mapped_file)
+{
+    memset(mapped_file, 0, sizeof(mapped_file_t));
+    mapped_file->file = INVALID_HANDLE_VALUE;
+
+    mapped_file->file =
+        CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped_file->file == INVALID_HANDLE_VALUE)
+    {
+        printf("Failed to create %s\n", file_name);
+        return false;
+    }
+
+    // Creating the mapping with the final size extends the file to exactly that length
+    ULARGE_INTEGER mapping_size;
+    mapping_size.QuadPart = (ULONGLONG)size;
+    mapped_file->mapping = CreateFileMappingA(mapped_file->file,
+        NULL,
+        PAGE_READWRITE,
+        mapping_size.HighPart,
+        mapping_size.LowPart,
+        NULL);
+    if (mapped_file->mapping == NULL)
+    {
+        printf("Failed to map %s\n", file_name);
+        mapped_file_close(mapped_file);
+        return false;
+    }
+
+    mapped_file->data = (uint8_t*)MapViewOfFile(mapped_file->mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (mapped_file->data == NULL)
+    {
+        printf("Failed to map view of %s\n", file_name);
+        mapped_file_close(mapped_file);
+        return false;
+    }
+    mapped_file->size = size;
+    return true;
+}
+
+bool mapped_file_close(mapped_file_t* mapped_file)
+{
+    bool succeeded = true;
+    if (mapped_file->data != NULL && !UnmapViewOfFile(mapped_file->data))
+    {
+        succeeded = false;
+    }
+    if (mapped_file->mapping != NULL && !CloseHandle(mapped_file->mapping))
+    {
+        succeeded = false;
+    }
+    if (mapped_file->file != INVALID_HANDLE_VALUE && !CloseHandle(mapped_file->file))
+    {
+        succeeded = false;
+    }
+    memset(mapped_file, 0, sizeof(mapped_file_t));
+    mapped_file->file = INVALID_HANDLE_VALUE;
+    return succeeded;
+}
+
+bool direct_file_create(const char* file_name, direct_file_t* direct_file)
+{
+    direct_file->failed = false;
+    direct_file->file = CreateFileA(file_name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (direct_file->file == INVALID_HANDLE_VALUE)
+    {
+        printf("Failed to create %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+// Writes at the position of overlapped, or at the end of the file when overlapped is NULL
+static void direct_file_write_chunks(direct_file_t* direct_file,
+    OVERLAPPED* overlapped,
+    uint64_t offset,
+    const void* data,
+    size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0 && !direct_file->failed)
+    {
+        DWORD chunk = (DWORD)std::min<size_t>(size, 1u << 30);
+        DWORD written = 0;
+        if (overlapped != NULL)
+        {
+            overlapped->Offset = (DWORD)offset;
+            overlapped->OffsetHigh = (DWORD)(offset >> 32);
+        }
+        if (!WriteFile(direct_file->file, bytes, chunk, &written, overlapped) || written == 0)
+        {
+            direct_file->failed = true;
+            return;
+        }
+        bytes += written;
+        offset += written;
+        size -= written;
+    }
+}
+
+void direct_file_write(direct_file_t* direct_file, const void* data, size_t size)
+{
+    direct_file_write_chunks(direct_file, NULL, 0, data, size);
+}
+
+void direct_file_write_at(direct_file_t* direct_file, uint64_t offset, const void* data, size_t size)
+{
+    // a positioned write on a synchronous handle still moves the file pointer, put it back afterwards
+    LARGE_INTEGER zero = {};
+    LARGE_INTEGER end;
+    if (!SetFilePointerEx(direct_file->file, zero, &end, FILE_CURRENT))
+    {
+        direct_file->failed = true;
+        return;
+    }
+    OVERLAPPED overlapped = {};
+    direct_file_write_chunks(direct_file, &overlapped, offset, data, size);
+    if (!SetFilePointerEx(direct_file->file, end, NULL, FILE_BEGIN))
+    {
+        direct_file->failed = true;
+    }
+}
+
+bool direct_file_close(direct_file_t* direct_file)
+{
+    bool succeeded = !direct_file->failed;
+    if (direct_file->file != INVALID_HANDLE_VALUE && !CloseHandle(direct_file->file))
+    {
+        succeeded = false;
+    }
+    direct_file->file = INVALID_HANDLE_VALUE;
+    return succeeded;
+}
+
+#else
+
+bool mapped_file_create(const char* file_name, size_t size, mapped_file_t* mapped_file)
+{
+    memset(mapped_file, 0, sizeof(mapped_file_t));
+    mapped_file->file = -1;
+
+    mapped_file->file = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mapped_file->file < 0)
+    {
+        printf("Failed to create %s\n", file_name);
+        return false;
+    }
+
+#ifdef __linux__
+    // Reserve the blocks now rather than faulting them in one page at a time through a sparse file
+    if (posix_fallocate(mapped_file->file, 0, (off_t)size) != 0 && ftruncate(mapped_file->file, (off_t)size) != 0)
+#else
+    if (ftruncate(mapped_file->file, (off_t)size) != 0)
+#endif
+    {
+        printf("Failed to resize %s\n", file_name);
+        mapped_file_close(mapped_file);
+        return false;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mapped_file->file, 0);
+    if (data == MAP_FAILED)
+    {
+        printf("Failed to map %s\n", file_name);
+        mapped_file_close(mapped_file);
+        return false;
+    }
+    mapped_file->data = (uint8_t*)data;
+    mapped_file->size = size;
+    return true;
+}
+
+bool mapped_file_close(mapped_file_t* mapped_file)
+{
+    bool succeeded = true;
+    if (mapped_file->data != NULL && munmap(mapped_file->data, mapped_file->size) != 0)
+    {
+        succeeded = false;
+    }
+    if (mapped_file->file >= 0 && close(mapped_file->file) != 0)
+    {
+        succeeded = false;
+    }
+    memset(mapped_file, 0, sizeof(mapped_file_t));
+    mapped_file->file = -1;
+    return succeeded;
+}
+
+bool direct_file_create(const char* file_name, direct_file_t* direct_file)
+{
+    direct_file->failed = false;
+    direct_file->file = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (direct_file->file < 0)
+    {
+        printf("Failed to create %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+void direct_file_write(direct_file_t* direct_file, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0 && !direct_file->failed)
+    {
+        ssize_t written = write(direct_file->file, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            direct_file->failed = true;
+            return;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+}
+
+void direct_file_write_at(direct_file_t* direct_file, uint64_t offset, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0 && !direct_file->failed)
+    {
+        ssize_t written = pwrite(direct_file->file, bytes, size, (off_t)offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            direct_file->failed = true;
+            return;
+        }
+        bytes += written;
+        offset += (uint64_t)written;
+        size -= (size_t)written;
+    }
+}
+
+bool direct_file_close(direct_file_t* direct_file)
+{
+    bool succeeded = !direct_file->failed;
+    if (direct_file->file >= 0 && close(direct_file->file) != 0)
+    {
+        succeeded = false;
+    }
+    direct_file->file = -1;
+    return succeeded;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Output file that is sized once up front and then written through a shared memory mapping, so data lands in the
+// page cache without passing through any user space stream buffer.
+struct mapped_file_t
+{
+    uint8_t* data;
+    size_t size;
+#ifdef _WIN32
+    void* file;    // HANDLE, kept opaque so this header does not pull in windows.h
+    void* mapping; // HANDLE
+#else
+    int file;
+#endif
+};
+
+// Creates (or truncates) file_name, preallocates exactly size bytes and maps them writable
+bool mapped_file_create(const char* file_name, size_t size, mapped_file_t* mapped_file);
+
+// Unmaps the view and closes the file. Returns false if any of the steps failed.
+bool mapped_file_close(mapped_file_t* mapped_file);
+
+// Output file written sequentially straight from the caller's buffers. Unlike a stream it has no buffer of its own, so
+// opening, writing and closing one allocates nothing on the heap.
+struct direct_file_t
+{
+#ifdef _WIN32
+    void* file;    // HANDLE
+#else
+    int file;
+#endif
+    bool failed;   // a write has failed, reported by direct_file_close
+};
+
+// Creates (or truncates) file_name for writing
+bool direct_file_create(const char* file_name, direct_file_t* direct_file);
+
+// Appends size bytes of data at the current end of the file
+void direct_file_write(direct_file_t* direct_file, const void* data, size_t size);
+
+// Overwrites size bytes at offset without moving the end the next direct_file_write appends at
+void direct_file_write_at(direct_file_t* direct_file, uint64_t offset, const void* data, size_t size);
+
+// Closes the file. Returns false if it or any of the writes failed.
+bool direct_file_close(direct_file_t* direct_file);
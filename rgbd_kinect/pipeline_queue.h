@@ -0,0 +1,215 @@
+#pragma once
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// Bounded multi-producer multi-consumer queue between two pipeline stages. Values move through a ring of cells with
+// Dmitry Vyukov's algorithm: every cell carries a sequence number that tells producers and consumers whose turn it
+// is, so pushing and popping only take a compare-and-swap on a shared position and never a lock. A thread only parks
+// on the mutex when the queue is full or empty, and is woken by the first operation that changes that.
+//
+// The queue knows how many producers feed it. Each one calls producer_done when it has pushed its last value, and
+// pop returns false once all of them are done and the queue has been drained.
+template <typename T> class bounded_mpmc_queue
+{
+public:
+    // A capacity below two is raised to two, with a single cell the sequence number of a full cell would be the
+    // one a producer expects of a free cell
+    bounded_mpmc_queue(size_t capacity, size_t producer_count) :
+        m_capacity(capacity > 2 ? capacity : 2),
+        m_cells(new cell_t[m_capacity]),
+        m_producers(producer_count)
+    {
+        for (size_t i = 0; i < m_capacity; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bounded_mpmc_queue(const bounded_mpmc_queue&) = delete;
+    bounded_mpmc_queue& operator=(const bounded_mpmc_queue&) = delete;
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    // Returns false without waiting if the queue is full
+    bool try_push(const T& value)
+    {
+        if (!enqueue(value))
+        {
+            return false;
+        }
+        wake(&m_waiting_consumers, &m_not_empty);
+        return true;
+    }
+
+    // Returns false without waiting if the queue is empty
+    bool try_pop(T* value)
+    {
+        if (!dequeue(value))
+        {
+            return false;
+        }
+        wake(&m_waiting_producers, &m_not_full);
+        return true;
+    }
+
+    // Waits while the queue is full
+    void push(const T& value)
+    {
+        if (try_push(value))
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiting_producers++;
+        while (!enqueue(value))
+        {
+            m_not_full.wait(lock);
+        }
+        m_waiting_producers--;
+        lock.unlock();
+        wake(&m_waiting_consumers, &m_not_empty);
+    }
+
+    // Waits while the queue is empty. Returns false once every producer is done and every value has been taken.
+    bool pop(T* value)
+    {
+        if (try_pop(value))
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiting_consumers++;
+        bool popped = false;
+        for (;;)
+        {
+            popped = dequeue(value);
+            if (popped)
+            {
+                break;
+            }
+            if (m_producers.load() == 0)
+            {
+                // the last producer pushed before it was done, so one more try sees everything it pushed
+                popped = dequeue(value);
+                break;
+            }
+            m_not_empty.wait(lock);
+        }
+        m_waiting_consumers--;
+        lock.unlock();
+        if (popped)
+        {
+            wake(&m_waiting_producers, &m_not_full);
+        }
+        return popped;
+    }
+
+    // Called by each producer after its last push
+    void producer_done()
+    {
+        if (m_producers.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_not_empty.notify_all();
+        }
+    }
+
+private:
+    struct cell_t
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    bool enqueue(const T& value)
+    {
+        size_t position = m_push_position.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell_t& cell = m_cells[position % m_capacity];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == position)
+            {
+                // the cell is free for this position, claim it unless another producer got there first
+                if (m_push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position)
+            {
+                // the consumer of the previous round has not taken the value yet, the queue is full
+                return false;
+            }
+            else
+            {
+                position = m_push_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool dequeue(T* value)
+    {
+        size_t position = m_pop_position.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell_t& cell = m_cells[position % m_capacity];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence == position + 1)
+            {
+                if (m_pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    *value = cell.value;
+                    // hands the cell to the producer of the next round
+                    cell.sequence.store(position + m_capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (sequence < position + 1)
+            {
+                // nothing has been pushed for this position yet, the queue is empty
+                return false;
+            }
+            else
+            {
+                position = m_pop_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // A waiter registers itself and then checks the queue once more, a thread that changed the queue checks for
+    // waiters afterwards. Both sides do a read-modify-write of the waiter count, and those are totally ordered: either
+    // this sees the waiter, or the waiter's increment comes later and synchronises with this one, so its last check
+    // sees the change. Either way no wakeup is lost.
+    void wake(std::atomic<size_t>* waiting, std::condition_variable* condition)
+    {
+        if (waiting->fetch_add(0) > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            condition->notify_all();
+        }
+    }
+
+    const size_t m_capacity;
+    std::unique_ptr<cell_t[]> m_cells;
+    // producers and consumers touch different positions, keeping them on separate cache lines avoids false sharing
+    alignas(64) std::atomic<size_t> m_push_position{ 0 };
+    alignas(64) std::atomic<size_t> m_pop_position{ 0 };
+    alignas(64) std::atomic<size_t> m_producers;
+    std::atomic<size_t> m_waiting_producers{ 0 };
+    std::atomic<size_t> m_waiting_consumers{ 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
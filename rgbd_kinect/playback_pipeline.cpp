@@ -0,0 +1,506 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "playback_pipeline.h"
+#include "transformation_cache.h"
+
+#include <chrono>
+#include <cstdio>
+
+typedef std::chrono::steady_clock pipeline_clock;
+
+static double seconds_since(pipeline_clock::time_point start)
+{
+    return std::chrono::duration<double>(pipeline_clock::now() - start).count();
+}
+
+static playback_pipeline_config_t pipeline_config_with_defaults(const playback_pipeline_config_t& config)
+{
+    playback_pipeline_config_t result = config;
+    result.decode_threads = result.decode_threads > 0 ? result.decode_threads : 1;
+    result.transform_threads = result.transform_threads > 0 ? result.transform_threads : 1;
+    if (result.read_queue_depth == 0)
+    {
+        result.read_queue_depth = result.decode_threads * 2;
+    }
+    if (result.decode_queue_depth == 0)
+    {
+        result.decode_queue_depth = result.transform_threads * 2;
+    }
+    if (result.write_queue_depth == 0)
+    {
+        result.write_queue_depth = 2;
+    }
+    if (result.range.stride == 0)
+    {
+        result.range.stride = 1;
+    }
+    return result;
+}
+
+playback_pipeline::playback_pipeline(k4a_playback_t playback, const playback_pipeline_config_t& config) :
+    m_playback(playback),
+    m_config(pipeline_config_with_defaults(config)),
+    // every place a frame can be: the queues, one frame per worker and the one the writer is writing
+    m_max_in_flight(m_config.read_queue_depth + m_config.decode_threads + m_config.decode_queue_depth +
+                    m_config.transform_threads + m_config.write_queue_depth + 1),
+    m_read_queue(m_config.read_queue_depth, 1),
+    m_decode_queue(m_config.decode_queue_depth, m_config.decode_threads),
+    m_write_queue(m_config.write_queue_depth, m_config.transform_threads)
+{
+    // a frame holds at most one decoded image, so decoding never waits for a buffer the writer will not release
+    m_decoder.reset(new jpeg_decoder_pool(m_config.decode_threads,
+        m_config.decode_width,
+        m_config.decode_height,
+        m_max_in_flight,
+        m_config.decode_output,
+        m_config.crop));
+    if (!m_decoder->is_valid())
+    {
+        printf("Failed to create jpeg decoder\n");
+        return;
+    }
+
+    // Transformation handles keep per-call scratch buffers, so they cannot be shared between threads. Each transform
+    // thread uses the cache slot of its index, which later runs with the same calibration reuse.
+    for (size_t i = 0; i < m_config.transform_threads; i++)
+    {
+        k4a_transformation_t transformation = transformation_cache_get(m_config.calibration, i);
+        if (transformation == NULL)
+        {
+            printf("Failed to create transformation handle\n");
+            return;
+        }
+        m_transformations.push_back(transformation);
+    }
+
+    m_stats.read.threads = 1;
+    m_stats.decode.threads = m_config.decode_threads;
+    m_stats.transform.threads = m_config.transform_threads;
+    m_stats.write.threads = 1;
+    m_valid = true;
+}
+
+bool playback_pipeline::is_valid() const
+{
+    return m_valid;
+}
+
+bool playback_pipeline::run()
+{
+    pipeline_clock::time_point start = pipeline_clock::now();
+    m_threads.push_back(std::thread(&playback_pipeline::read, this));
+    for (size_t i = 0; i < m_config.decode_threads; i++)
+    {
+        m_threads.push_back(std::thread(&playback_pipeline::decode, this, i));
+    }
+    for (size_t i = 0; i < m_config.transform_threads; i++)
+    {
+        m_threads.push_back(std::thread(&playback_pipeline::transform, this, i));
+    }
+    m_threads.push_back(std::thread(&playback_pipeline::write, this));
+
+    for (std::thread& thread : m_threads)
+    {
+        thread.join();
+    }
+    m_threads.clear();
+
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    m_stats.wall_seconds = seconds_since(start);
+    return !m_failed.load();
+}
+
+playback_pipeline_stats_t playback_pipeline::get_stats()
+{
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    return m_stats;
+}
+
+void playback_pipeline::read()
+{
+    pipeline_stage_stats_t stats = {};
+    size_t capture_count = 0; // complete captures seen, including the ones the stride skips
+    size_t read_count = 0;
+    for (;;)
+    {
+        if (m_config.range.frame_limit > 0 && read_count >= m_config.range.frame_limit)
+        {
+            break;
+        }
+
+        pipeline_clock::time_point wait_start = pipeline_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(m_window_mutex);
+            m_window_free.wait(lock, [this] { return m_in_flight < m_max_in_flight || m_stopping.load(); });
+        }
+        stats.blocked_seconds += seconds_since(wait_start);
+        if (m_stopping.load())
+        {
+            break;
+        }
+
+        // skipped captures are read inside read_frame, so their time counts as busy too
+        pipeline_clock::time_point read_start = pipeline_clock::now();
+        frame_t frame = {};
+        k4a_stream_result_t stream_result = read_frame(&frame, &capture_count);
+        stats.busy_seconds += seconds_since(read_start);
+        if (stream_result == K4A_STREAM_RESULT_EOF)
+        {
+            break;
+        }
+        if (stream_result == K4A_STREAM_RESULT_FAILED)
+        {
+            // the files written so far would be silently short of the range, so the run fails
+            printf("Failed to read capture from recording\n");
+            {
+                std::lock_guard<std::mutex> lock(m_stats_mutex);
+                m_stats.read_failed++;
+            }
+            stop();
+            break;
+        }
+
+        frame.index = read_count++;
+        {
+            std::lock_guard<std::mutex> lock(m_window_mutex);
+            m_in_flight++;
+        }
+        stats.frames++;
+
+        pipeline_clock::time_point push_start = pipeline_clock::now();
+        m_read_queue.push(frame);
+        stats.blocked_seconds += seconds_since(push_start);
+    }
+
+    m_read_queue.producer_done();
+    add_stats(&m_stats.read, stats);
+}
+
+k4a_stream_result_t playback_pipeline::read_frame(frame_t* frame, size_t* capture_count)
+{
+    for (;;)
+    {
+        if (m_stopping.load())
+        {
+            return K4A_STREAM_RESULT_EOF;
+        }
+
+        k4a_capture_t capture = NULL;
+        k4a_stream_result_t stream_result;
+        if (m_config.capture_reader != NULL)
+        {
+            stream_result = m_config.capture_reader->next(&capture);
+        }
+        else
+        {
+            stream_result = k4a_playback_get_next_capture(m_playback, &capture);
+        }
+        if (stream_result == K4A_STREAM_RESULT_EOF)
+        {
+            return K4A_STREAM_RESULT_EOF;
+        }
+        if (stream_result != K4A_STREAM_RESULT_SUCCEEDED || capture == NULL)
+        {
+            return K4A_STREAM_RESULT_FAILED;
+        }
+
+        frame->capture = capture;
+        frame->depth_image = k4a_capture_get_depth_image(capture);
+        frame->compressed_image = k4a_capture_get_color_image(capture);
+        if (frame->depth_image == NULL || frame->compressed_image == NULL)
+        {
+            release_frame(frame);
+            std::lock_guard<std::mutex> lock(m_stats_mutex);
+            m_stats.skipped++;
+            continue;
+        }
+        // a seek lands on the first capture with any image at or after its timestamp, whose depth image may still be
+        // before the range
+        uint64_t timestamp_usec = k4a_image_get_device_timestamp_usec(frame->depth_image);
+        if (timestamp_usec < m_config.range.begin_timestamp_usec)
+        {
+            release_frame(frame);
+            continue;
+        }
+        if (m_config.range.end_timestamp_usec > 0 && timestamp_usec >= m_config.range.end_timestamp_usec)
+        {
+            release_frame(frame);
+            return K4A_STREAM_RESULT_EOF;
+        }
+        // captures the stride skips are released here, before anything is spent decoding them
+        if ((*capture_count)++ % m_config.range.stride != 0)
+        {
+            release_frame(frame);
+            continue;
+        }
+        return K4A_STREAM_RESULT_SUCCEEDED;
+    }
+}
+
+void playback_pipeline::decode(size_t worker)
+{
+    pipeline_stage_stats_t stats = {};
+    for (;;)
+    {
+        frame_t frame;
+        pipeline_clock::time_point wait_start = pipeline_clock::now();
+        if (!m_read_queue.pop(&frame))
+        {
+            break;
+        }
+        stats.starved_seconds += seconds_since(wait_start);
+
+        pipeline_clock::time_point decode_start = pipeline_clock::now();
+        if (!m_stopping.load())
+        {
+            frame.color_image = m_decoder->decode(worker, frame.compressed_image);
+            if (frame.color_image == NULL)
+            {
+                // dropped, the frames after it are still converted
+                frame.failed = true;
+                std::lock_guard<std::mutex> lock(m_stats_mutex);
+                m_stats.decode_failed++;
+            }
+        }
+        else
+        {
+            frame.failed = true;
+        }
+        k4a_image_release(frame.compressed_image);
+        frame.compressed_image = NULL;
+        stats.busy_seconds += seconds_since(decode_start);
+        stats.frames++;
+
+        // even a dropped frame goes on to the writer, which keeps the write order and the count of frames in flight
+        pipeline_clock::time_point push_start = pipeline_clock::now();
+        m_decode_queue.push(frame);
+        stats.blocked_seconds += seconds_since(push_start);
+    }
+
+    m_decode_queue.producer_done();
+    add_stats(&m_stats.decode, stats);
+}
+
+void playback_pipeline::transform(size_t worker)
+{
+    pipeline_stage_stats_t stats = {};
+    k4a_transformation_t transformation = m_transformations[worker];
+    for (;;)
+    {
+        frame_t frame;
+        pipeline_clock::time_point wait_start = pipeline_clock::now();
+        if (!m_decode_queue.pop(&frame))
+        {
+            break;
+        }
+        stats.starved_seconds += seconds_since(wait_start);
+
+        pipeline_clock::time_point transform_start = pipeline_clock::now();
+        if (!frame.failed && !m_stopping.load())
+        {
+            int width = k4a_image_get_width_pixels(frame.color_image);
+            int height = k4a_image_get_height_pixels(frame.color_image);
+            image_handle transformed_depth(
+                frame_pool_transform_depth(&m_frame_pool, transformation, frame.depth_image, width, height));
+            if (m_config.rays != NULL)
+            {
+                // the writer computes the points from the transformed depth image while it writes
+                frame.points = transformed_depth.release();
+            }
+            else if (transformed_depth.get() != NULL)
+            {
+                frame.points = frame_pool_point_cloud(&m_frame_pool,
+                    transformation,
+                    transformed_depth.get(),
+                    K4A_CALIBRATION_TYPE_COLOR);
+            }
+            if (frame.points == NULL)
+            {
+                printf("failed to transform depth to color for frame %zu\n", frame.index);
+                frame.failed = true;
+                {
+                    std::lock_guard<std::mutex> lock(m_stats_mutex);
+                    m_stats.failed++;
+                }
+                stop();
+            }
+        }
+        else
+        {
+            frame.failed = true;
+        }
+
+        // the writer only needs the points and the colors
+        k4a_image_release(frame.depth_image);
+        frame.depth_image = NULL;
+        k4a_capture_release(frame.capture);
+        frame.capture = NULL;
+        stats.busy_seconds += seconds_since(transform_start);
+        stats.frames++;
+
+        pipeline_clock::time_point push_start = pipeline_clock::now();
+        m_write_queue.push(frame);
+        stats.blocked_seconds += seconds_since(push_start);
+    }
+
+    m_write_queue.producer_done();
+    add_stats(&m_stats.transform, stats);
+}
+
+void playback_pipeline::write()
+{
+    pipeline_stage_stats_t stats = {};
+    // Transform threads finish frames out of order, the ones ahead of the next frame to write wait here. A frame
+    // counts against the in-flight window from the time it is read until it is written, so every waiting frame is
+    // less than m_max_in_flight ahead of the next one and its slot, index modulo m_max_in_flight, is free.
+    std::vector<frame_t> pending(m_max_in_flight);
+    std::vector<bool> pending_present(m_max_in_flight, false);
+    std::string file_name;
+    size_t next_index = 0;
+    for (;;)
+    {
+        size_t next_slot = next_index % m_max_in_flight;
+        if (!pending_present[next_slot])
+        {
+            frame_t frame;
+            pipeline_clock::time_point wait_start = pipeline_clock::now();
+            if (!m_write_queue.pop(&frame))
+            {
+                break;
+            }
+            stats.starved_seconds += seconds_since(wait_start);
+            pending[frame.index % m_max_in_flight] = frame;
+            pending_present[frame.index % m_max_in_flight] = true;
+            continue;
+        }
+
+        frame_t frame = pending[next_slot];
+        pending_present[next_slot] = false;
+        pipeline_clock::time_point write_start = pipeline_clock::now();
+        if (!frame.failed && !m_stopping.load())
+        {
+            m_config.file_name(frame.index, &file_name);
+            bool succeeded;
+            if (m_config.rays != NULL)
+            {
+                succeeded = tranformation_helpers_write_depth_point_cloud(m_config.rays,
+                    frame.points,
+                    frame.color_image,
+                    file_name.c_str(),
+                    m_config.ply_options);
+            }
+            else
+            {
+                succeeded = tranformation_helpers_write_point_cloud(frame.points,
+                    frame.color_image,
+                    file_name.c_str(),
+                    m_config.ply_options);
+            }
+
+            std::lock_guard<std::mutex> lock(m_stats_mutex);
+            if (succeeded)
+            {
+                m_stats.written++;
+            }
+            else
+            {
+                printf("failed to write point cloud %s\n", file_name.c_str());
+                m_stats.failed++;
+            }
+            stats.frames++;
+            if (!succeeded)
+            {
+                stop();
+            }
+        }
+        release_frame(&frame);
+        stats.busy_seconds += seconds_since(write_start);
+        next_index++;
+
+        {
+            std::lock_guard<std::mutex> lock(m_window_mutex);
+            m_in_flight--;
+        }
+        m_window_free.notify_one();
+    }
+
+    // every frame read reaches the writer, so nothing is left here unless an index went missing
+    for (size_t slot = 0; slot < m_max_in_flight; slot++)
+    {
+        if (pending_present[slot])
+        {
+            release_frame(&pending[slot]);
+        }
+    }
+    add_stats(&m_stats.write, stats);
+}
+
+void playback_pipeline::stop()
+{
+    m_failed.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m_window_mutex);
+        m_stopping.store(true);
+    }
+    m_window_free.notify_all();
+}
+
+void playback_pipeline::add_stats(pipeline_stage_stats_t* stage, const pipeline_stage_stats_t& thread_stats)
+{
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    stage->frames += thread_stats.frames;
+    stage->busy_seconds += thread_stats.busy_seconds;
+    stage->starved_seconds += thread_stats.starved_seconds;
+    stage->blocked_seconds += thread_stats.blocked_seconds;
+}
+
+void playback_pipeline::release_frame(frame_t* frame)
+{
+    k4a_image_t* images[] = { &frame->points, &frame->color_image, &frame->compressed_image, &frame->depth_image };
+    for (k4a_image_t* image : images)
+    {
+        if (*image != NULL)
+        {
+            k4a_image_release(*image);
+            *image = NULL;
+        }
+    }
+    if (frame->capture != NULL)
+    {
+        k4a_capture_release(frame->capture);
+        frame->capture = NULL;
+    }
+}
+
+static void print_stage_stats(const char* name, const pipeline_stage_stats_t& stage, double wall_seconds)
+{
+    // share of the time the stage's threads had available
+    double available = wall_seconds * (double)stage.threads;
+    double scale = available > 0 ? 100.0 / available : 0;
+    printf("  %-10s %7zu %7zu %6.1f%% %7.1f%% %7.1f%%\n",
+        name,
+        stage.threads,
+        stage.frames,
+        stage.busy_seconds * scale,
+        stage.starved_seconds * scale,
+        stage.blocked_seconds * scale);
+}
+
+void print_playback_pipeline_stats(const playback_pipeline_stats_t& stats)
+{
+    printf("pipeline: %zu point clouds written in %.3f s (%.1f fps), %zu failed, %zu undecodable frames dropped, "
+           "%zu incomplete captures skipped, %zu read errors\n",
+        stats.written,
+        stats.wall_seconds,
+        stats.wall_seconds > 0 ? (double)stats.written / stats.wall_seconds : 0,
+        stats.failed,
+        stats.decode_failed,
+        stats.skipped,
+        stats.read_failed);
+    printf("  %-10s %7s %7s %7s %8s %8s\n", "stage", "threads", "frames", "busy", "starved", "blocked");
+    print_stage_stats("read", stats.read, stats.wall_seconds);
+    print_stage_stats("decode", stats.decode, stats.wall_seconds);
+    print_stage_stats("transform", stats.transform, stats.wall_seconds);
+    print_stage_stats("write", stats.write, stats.wall_seconds);
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <k4a/k4a.h>
+#include <k4arecord/playback.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_pool.h"
+#include "jpeg_decoder.h"
+#include "pipeline_queue.h"
+#include "recording_index.h"
+#include "transformation_helpers.h"
+
+// The captures a playback pipeline converts, counted from the playback position it starts at
+struct playback_range_t
+{
+    // Device timestamps compared with the depth image of each capture. Captures before begin are skipped, reading
+    // stops at end, 0 reads to the end of the recording.
+    uint64_t begin_timestamp_usec;
+    uint64_t end_timestamp_usec;
+    size_t stride;               // only every stride-th complete capture is decoded and converted
+    size_t frame_limit;          // stop after reading this many frames, 0 for no limit
+};
+
+// Every complete capture up to the end of the recording
+static const playback_range_t PLAYBACK_RANGE_INIT_ALL = { 0, 0, 1, 0 };
+
+struct playback_pipeline_config_t
+{
+    size_t decode_threads;
+    size_t transform_threads;    // each one with its own transformation handle
+    size_t read_queue_depth;     // captures read ahead of the decode threads, 0 picks two per decode thread
+    size_t decode_queue_depth;   // decoded frames waiting for a transform thread, 0 picks two per transform thread
+    size_t write_queue_depth;    // point clouds waiting for the writer, 0 picks two
+    int decode_width;            // size of a whole decoded color frame
+    int decode_height;
+    jpeg_output_t decode_output;
+    const color_roi_t* crop;     // decode only this region of each color frame, NULL decodes all of it
+    const k4a_calibration_t* calibration; // matches the decoded, possibly scaled and cropped, color images
+    const ray_table_t* rays;     // color camera rays of calibration, NULL computes points with the SDK
+    ply_write_options_t ply_options;
+    playback_range_t range;
+    indexed_capture_reader* capture_reader; // reads the captures it selects instead, NULL reads from the playback
+                                            // position on
+    // Sets file_name to the output file of the frame_index-th frame read. The writer passes the same string every
+    // time, so assigning into it reuses its buffer.
+    std::function<void(size_t frame_index, std::string* file_name)> file_name;
+};
+
+// Time the threads of one stage spent working and waiting, summed over the threads
+struct pipeline_stage_stats_t
+{
+    size_t threads;
+    size_t frames;          // frames the stage handled
+    double busy_seconds;
+    double starved_seconds; // waiting for input from the stage before
+    double blocked_seconds; // waiting for room in the stage after
+};
+
+struct playback_pipeline_stats_t
+{
+    double wall_seconds;
+    pipeline_stage_stats_t read;
+    pipeline_stage_stats_t decode;
+    pipeline_stage_stats_t transform;
+    pipeline_stage_stats_t write;
+    size_t skipped;         // captures without both a depth and a color image
+    size_t decode_failed;   // frames dropped because their color image could not be decoded
+    size_t read_failed;     // captures that could not be read, which stops the run
+    size_t written;
+    size_t failed;          // frames that could not be transformed or written
+};
+
+// Converts a range of a recording into colored point clouds with every step on its own threads, so demuxing, JPEG
+// decoding, transformation and disk writes of different frames overlap:
+//
+//   reader -> read queue -> decode threads -> decode queue -> transform threads -> write queue -> writer
+//
+// One thread reads captures from the playback handle, a pool of threads decodes their MJPEG color images, a pool
+// with one transformation handle per thread turns depth into point clouds in the color camera, and one thread writes
+// the PLY files in read order. The stages are connected by bounded lock-free queues, and the number of frames
+// between the reader and the writer is capped, which bounds the memory in flight and lets decoded images come from a
+// fixed set of buffers. A failed read, transformation or write stops reading, and the frames already in flight are
+// dropped.
+class playback_pipeline
+{
+public:
+    // The pipeline reads from playback starting at its current position, or the captures config.capture_reader selects
+    playback_pipeline(k4a_playback_t playback, const playback_pipeline_config_t& config);
+
+    playback_pipeline(const playback_pipeline&) = delete;
+    playback_pipeline& operator=(const playback_pipeline&) = delete;
+
+    // False if a decoder or transformation handle could not be created
+    bool is_valid() const;
+
+    // Converts the whole range and returns once every stage has finished. False if a capture could not be read or any
+    // frame could not be transformed or written. Runs once.
+    bool run();
+
+    playback_pipeline_stats_t get_stats();
+
+private:
+    struct frame_t
+    {
+        size_t index;              // position in read order, the order files are written in
+        k4a_capture_t capture;
+        k4a_image_t depth_image;
+        k4a_image_t compressed_image;
+        k4a_image_t color_image;   // decoded, borrowed from the decoder pool
+        k4a_image_t points;        // point cloud, or the transformed depth image when the points come from rays
+        bool failed;               // dropped on the way, the writer only releases it
+    };
+
+    void read();
+    // Reads captures until one is complete, inside the range and not skipped by the stride. EOF at the end of the
+    // recording or the range, or once the pipeline is stopping.
+    k4a_stream_result_t read_frame(frame_t* frame, size_t* capture_count);
+    void decode(size_t worker);
+    void transform(size_t worker);
+    void write();
+
+    // Marks the run failed and stops the reader, the stages after it drop whatever they still receive
+    void stop();
+    void add_stats(pipeline_stage_stats_t* stage, const pipeline_stage_stats_t& thread_stats);
+    static void release_frame(frame_t* frame);
+
+    k4a_playback_t m_playback;
+    playback_pipeline_config_t m_config;
+    size_t m_max_in_flight;
+    bool m_valid = false;
+
+    std::unique_ptr<jpeg_decoder_pool> m_decoder;
+    std::vector<k4a_transformation_t> m_transformations; // from transformation_cache_get, one slot per transform thread
+    frame_buffer_pool m_frame_pool; // buffers of the point clouds and transformed depth images
+
+    bounded_mpmc_queue<frame_t> m_read_queue;
+    bounded_mpmc_queue<frame_t> m_decode_queue;
+    bounded_mpmc_queue<frame_t> m_write_queue;
+
+    // frames between the reader and the writer, the reader waits while the cap is reached
+    std::mutex m_window_mutex;
+    std::condition_variable m_window_free;
+    size_t m_in_flight = 0;
+
+    std::atomic<bool> m_stopping{ false };
+    std::atomic<bool> m_failed{ false };
+
+    std::mutex m_stats_mutex;
+    playback_pipeline_stats_t m_stats = {};
+
+    std::vector<std::thread> m_threads;
+};
+
+// Prints how busy each stage was. The stage closest to 100% busy limits the frame rate, a stage that is mostly
+// starved or blocked has more threads than it needs.
+void print_playback_pipeline_stats(const playback_pipeline_stats_t& stats);
@@ -0,0 +1,77 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "point_cloud.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+void* aligned_buffer_allocate(size_t size)
+{
+    // aligned_alloc wants a multiple of the alignment
+    size = (size + POINT_CLOUD_ALIGNMENT - 1) / POINT_CLOUD_ALIGNMENT * POINT_CLOUD_ALIGNMENT;
+#ifdef _WIN32
+    return _aligned_malloc(size, POINT_CLOUD_ALIGNMENT);
+#else
+    return aligned_alloc(POINT_CLOUD_ALIGNMENT, size > 0 ? size : POINT_CLOUD_ALIGNMENT);
+#endif
+}
+
+void aligned_buffer_free(void* buffer)
+{
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+static size_t aligned_array_size(size_t capacity, size_t element_size)
+{
+    return (capacity * element_size + POINT_CLOUD_ALIGNMENT - 1) / POINT_CLOUD_ALIGNMENT * POINT_CLOUD_ALIGNMENT;
+}
+
+bool point_cloud_create(size_t capacity, bool with_normals, point_cloud_t* cloud)
+{
+    memset(cloud, 0, sizeof(point_cloud_t));
+
+    size_t coordinate_size = aligned_array_size(capacity, sizeof(int16_t));
+    size_t color_size = aligned_array_size(capacity, sizeof(uint8_t));
+    size_t normal_size = with_normals ? aligned_array_size(capacity, sizeof(float)) : 0;
+    uint8_t* allocation = (uint8_t*)aligned_buffer_allocate(3 * coordinate_size + 3 * color_size + 3 * normal_size);
+    if (allocation == NULL)
+    {
+        return false;
+    }
+
+    cloud->allocation = allocation;
+    cloud->capacity = capacity;
+    cloud->x = (int16_t*)(void*)allocation;
+    cloud->y = (int16_t*)(void*)(allocation + coordinate_size);
+    cloud->z = (int16_t*)(void*)(allocation + 2 * coordinate_size);
+    allocation += 3 * coordinate_size;
+    cloud->red = allocation;
+    cloud->green = allocation + color_size;
+    cloud->blue = allocation + 2 * color_size;
+    allocation += 3 * color_size;
+    if (with_normals)
+    {
+        cloud->normal_x = (float*)(void*)allocation;
+        cloud->normal_y = (float*)(void*)(allocation + normal_size);
+        cloud->normal_z = (float*)(void*)(allocation + 2 * normal_size);
+    }
+    return true;
+}
+
+void point_cloud_destroy(point_cloud_t* cloud)
+{
+    if (cloud->allocation != NULL)
+    {
+        aligned_buffer_free(cloud->allocation);
+    }
+    memset(cloud, 0, sizeof(point_cloud_t));
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Alignment of every array in a point_cloud_t, one cache line and enough for any SIMD load
+#define POINT_CLOUD_ALIGNMENT 64
+
+// Structure-of-arrays point cloud shared by the extraction kernels and the PLY writer. Coordinates are millimetres
+// in the camera the cloud was computed in, colors are RGB. Every array holds capacity elements and starts on a
+// POINT_CLOUD_ALIGNMENT boundary. The normal arrays are NULL unless the cloud was created with normals.
+struct point_cloud_t
+{
+    size_t size;
+    size_t capacity;
+    int16_t* x;
+    int16_t* y;
+    int16_t* z;
+    uint8_t* red;
+    uint8_t* green;
+    uint8_t* blue;
+    float* normal_x;
+    float* normal_y;
+    float* normal_z;
+    void* allocation; // single block backing all of the arrays above
+};
+
+// Allocates an empty cloud that can hold capacity points
+bool point_cloud_create(size_t capacity, bool with_normals, point_cloud_t* cloud);
+
+void point_cloud_destroy(point_cloud_t* cloud);
+
+static inline bool point_cloud_has_normals(const point_cloud_t* cloud)
+{
+    return cloud->normal_x != NULL;
+}
+
+// Allocation helpers for POINT_CLOUD_ALIGNMENT aligned buffers, free with aligned_buffer_free
+void* aligned_buffer_allocate(size_t size);
+void aligned_buffer_free(void* buffer);
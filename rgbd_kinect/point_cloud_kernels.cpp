@@ -0,0 +1,330 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "point_cloud_kernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define POINT_CLOUD_KERNELS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define POINT_CLOUD_KERNELS_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline bool pixel_is_valid(const int16_t* xyz, const uint8_t* bgra, size_t i)
+{
+    uint32_t color;
+    memcpy(&color, bgra + 4 * i, sizeof(color));
+    return xyz[3 * i + 2] != 0 && color != 0;
+}
+
+static inline void append_point(const int16_t* xyz, const uint8_t* bgra, size_t i, point_cloud_t* cloud)
+{
+    size_t n = cloud->size++;
+    cloud->x[n] = xyz[3 * i + 0];
+    cloud->y[n] = xyz[3 * i + 1];
+    cloud->z[n] = xyz[3 * i + 2];
+    // image data is BGR
+    cloud->red[n] = bgra[4 * i + 2];
+    cloud->green[n] = bgra[4 * i + 1];
+    cloud->blue[n] = bgra[4 * i + 0];
+}
+
+// Appends pixel column of the row whose first pixel is at xyz + 3 * row_offset, converting its color from the YUV
+// samples of the row
+static inline void append_point_yuv(const int16_t* xyz,
+    const yuv_planes_t* planes,
+    ptrdiff_t row_offset,
+    const uint8_t* y_row,
+    const uint8_t* u_row,
+    const uint8_t* v_row,
+    size_t column,
+    point_cloud_t* cloud)
+{
+    ptrdiff_t i = row_offset + (ptrdiff_t)column;
+    size_t n = cloud->size++;
+    cloud->x[n] = xyz[3 * i + 0];
+    cloud->y[n] = xyz[3 * i + 1];
+    cloud->z[n] = xyz[3 * i + 2];
+    size_t chroma_column = column >> planes->chroma_shift_x;
+    yuv_pixel_to_rgb(y_row[column],
+        u_row[chroma_column],
+        v_row[chroma_column],
+        &cloud->red[n],
+        &cloud->green[n],
+        &cloud->blue[n]);
+}
+
+static inline unsigned int count_trailing_zeros(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned int)index;
+#else
+    return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned int count_bits(uint32_t mask)
+{
+    mask = mask - ((mask >> 1) & 0x55555555u);
+    mask = (mask & 0x33333333u) + ((mask >> 2) & 0x33333333u);
+    return (((mask + (mask >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+#if defined(POINT_CLOUD_KERNELS_AVX2)
+
+#define POINT_CLOUD_KERNEL_WIDTH 16
+#define POINT_CLOUD_KERNEL_FULL_MASK 0xFFFFu
+
+// Bit k is set if pixel i + k has no depth
+static inline uint32_t no_depth_mask(const int16_t* xyz, size_t i)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    // The 48 interleaved coordinates give two mask bits per int16, the z of pixel k sits at bit 6 * k + 4
+    const int16_t* points = xyz + 3 * i;
+    __m256i xyz_0 = _mm256_loadu_si256((const __m256i*)(points + 0));
+    __m256i xyz_1 = _mm256_loadu_si256((const __m256i*)(points + 16));
+    __m256i xyz_2 = _mm256_loadu_si256((const __m256i*)(points + 32));
+    uint64_t zero_low = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(xyz_0, zero)) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(xyz_1, zero)) << 32;
+    uint32_t zero_high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(xyz_2, zero));
+    uint32_t no_depth = 0;
+    for (unsigned int k = 0; k < 10; k++)
+    {
+        no_depth |= (uint32_t)((zero_low >> (6 * k + 4)) & 1) << k;
+    }
+    for (unsigned int k = 10; k < 16; k++)
+    {
+        no_depth |= ((zero_high >> (6 * k + 4 - 64)) & 1) << k;
+    }
+    return no_depth;
+}
+
+// Bit k is set if pixel i + k has depth and color
+static inline uint32_t valid_mask(const int16_t* xyz, const uint8_t* bgra, size_t i)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    // one 32 bit lane per BGRA pixel, all zero means no color
+    __m256i color_0 = _mm256_loadu_si256((const __m256i*)(bgra + 4 * i));
+    __m256i color_1 = _mm256_loadu_si256((const __m256i*)(bgra + 4 * i + 32));
+    uint32_t no_color = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(color_0, zero))) |
+                        (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(color_1, zero))) << 8;
+
+    return ~(no_color | no_depth_mask(xyz, i)) & POINT_CLOUD_KERNEL_FULL_MASK;
+}
+
+#elif defined(POINT_CLOUD_KERNELS_SSE2)
+
+#define POINT_CLOUD_KERNEL_WIDTH 8
+#define POINT_CLOUD_KERNEL_FULL_MASK 0xFFu
+
+// Bit k is set if pixel i + k has no depth
+static inline uint32_t no_depth_mask(const int16_t* xyz, size_t i)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    // The 24 interleaved coordinates give two mask bits per int16, the z of pixel k sits at bit 6 * k + 4
+    const int16_t* points = xyz + 3 * i;
+    __m128i xyz_0 = _mm_loadu_si128((const __m128i*)(points + 0));
+    __m128i xyz_1 = _mm_loadu_si128((const __m128i*)(points + 8));
+    __m128i xyz_2 = _mm_loadu_si128((const __m128i*)(points + 16));
+    uint64_t zero_bits = (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(xyz_0, zero)) |
+                         (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(xyz_1, zero)) << 16 |
+                         (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(xyz_2, zero)) << 32;
+    uint32_t no_depth = 0;
+    for (unsigned int k = 0; k < 8; k++)
+    {
+        no_depth |= (uint32_t)((zero_bits >> (6 * k + 4)) & 1) << k;
+    }
+    return no_depth;
+}
+
+// Bit k is set if pixel i + k has depth and color
+static inline uint32_t valid_mask(const int16_t* xyz, const uint8_t* bgra, size_t i)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    // one 32 bit lane per BGRA pixel, all zero means no color
+    __m128i color_0 = _mm_loadu_si128((const __m128i*)(bgra + 4 * i));
+    __m128i color_1 = _mm_loadu_si128((const __m128i*)(bgra + 4 * i + 16));
+    uint32_t no_color = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(color_0, zero))) |
+                        (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(color_1, zero))) << 4;
+
+    return ~(no_color | no_depth_mask(xyz, i)) & POINT_CLOUD_KERNEL_FULL_MASK;
+}
+
+#endif
+
+size_t point_cloud_extract_scalar(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count, point_cloud_t* cloud)
+{
+    size_t first = cloud->size;
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        if (pixel_is_valid(xyz, bgra, i))
+        {
+            append_point(xyz, bgra, i, cloud);
+        }
+    }
+    return cloud->size - first;
+}
+
+size_t point_cloud_count_valid_scalar(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        count += pixel_is_valid(xyz, bgra, i) ? 1 : 0;
+    }
+    return count;
+}
+
+size_t point_cloud_extract(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count, point_cloud_t* cloud)
+{
+#ifdef POINT_CLOUD_KERNEL_WIDTH
+    size_t first = cloud->size;
+    size_t i = 0;
+    for (; i + POINT_CLOUD_KERNEL_WIDTH <= pixel_count; i += POINT_CLOUD_KERNEL_WIDTH)
+    {
+        uint32_t mask = valid_mask(xyz, bgra, i);
+        if (mask == POINT_CLOUD_KERNEL_FULL_MASK)
+        {
+            // dense regions are the common case inside the depth frustum
+            for (size_t k = 0; k < POINT_CLOUD_KERNEL_WIDTH; k++)
+            {
+                append_point(xyz, bgra, i + k, cloud);
+            }
+            continue;
+        }
+        while (mask != 0)
+        {
+            append_point(xyz, bgra, i + count_trailing_zeros(mask), cloud);
+            mask &= mask - 1;
+        }
+    }
+    point_cloud_extract_scalar(xyz + 3 * i, bgra + 4 * i, pixel_count - i, cloud);
+    return cloud->size - first;
+#else
+    return point_cloud_extract_scalar(xyz, bgra, pixel_count, cloud);
+#endif
+}
+
+size_t point_cloud_count_valid(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count)
+{
+#ifdef POINT_CLOUD_KERNEL_WIDTH
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + POINT_CLOUD_KERNEL_WIDTH <= pixel_count; i += POINT_CLOUD_KERNEL_WIDTH)
+    {
+        count += count_bits(valid_mask(xyz, bgra, i));
+    }
+    return count + point_cloud_count_valid_scalar(xyz + 3 * i, bgra + 4 * i, pixel_count - i);
+#else
+    return point_cloud_count_valid_scalar(xyz, bgra, pixel_count);
+#endif
+}
+
+size_t point_cloud_extract_yuv(const int16_t* xyz,
+    const yuv_planes_t* planes,
+    size_t begin,
+    size_t end,
+    point_cloud_t* cloud)
+{
+    size_t first = cloud->size;
+    size_t width = (size_t)planes->width;
+    // walk the range row by row so every row has a single set of plane pointers
+    for (size_t row = begin / width; row * width < end; row++)
+    {
+        size_t row_begin = row * width;
+        // xyz starts at pixel begin, the first row of the range can start before it
+        ptrdiff_t row_offset = (ptrdiff_t)row_begin - (ptrdiff_t)begin;
+        size_t column = begin > row_begin ? begin - row_begin : 0;
+        size_t column_end = std::min(width, end - row_begin);
+        const uint8_t* y_row = planes->y + row * width;
+        const uint8_t* u_row = planes->u + (row >> planes->chroma_shift_y) * (size_t)planes->chroma_width;
+        const uint8_t* v_row = planes->v + (row >> planes->chroma_shift_y) * (size_t)planes->chroma_width;
+
+#ifdef POINT_CLOUD_KERNEL_WIDTH
+        for (; column + POINT_CLOUD_KERNEL_WIDTH <= column_end; column += POINT_CLOUD_KERNEL_WIDTH)
+        {
+            uint32_t mask = ~no_depth_mask(xyz, (size_t)(row_offset + (ptrdiff_t)column)) &
+                            POINT_CLOUD_KERNEL_FULL_MASK;
+            while (mask != 0)
+            {
+                append_point_yuv(xyz,
+                    planes,
+                    row_offset,
+                    y_row,
+                    u_row,
+                    v_row,
+                    column + count_trailing_zeros(mask),
+                    cloud);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; column < column_end; column++)
+        {
+            if (xyz[3 * (row_offset + (ptrdiff_t)column) + 2] != 0)
+            {
+                append_point_yuv(xyz, planes, row_offset, y_row, u_row, v_row, column, cloud);
+            }
+        }
+    }
+    return cloud->size - first;
+}
+
+size_t point_cloud_count_valid_depth(const int16_t* xyz, size_t pixel_count)
+{
+    size_t count = 0;
+    size_t i = 0;
+#ifdef POINT_CLOUD_KERNEL_WIDTH
+    for (; i + POINT_CLOUD_KERNEL_WIDTH <= pixel_count; i += POINT_CLOUD_KERNEL_WIDTH)
+    {
+        count += POINT_CLOUD_KERNEL_WIDTH - count_bits(no_depth_mask(xyz, i));
+    }
+#endif
+    for (; i < pixel_count; i++)
+    {
+        count += xyz[3 * i + 2] != 0 ? 1 : 0;
+    }
+    return count;
+}
+
+size_t point_cloud_filter_depth_range(point_cloud_t* cloud, size_t first, int min_z, int max_z)
+{
+    size_t kept = first;
+    for (size_t i = first; i < cloud->size; i++)
+    {
+        if (cloud->z[i] < min_z || cloud->z[i] > max_z)
+        {
+            continue;
+        }
+        cloud->x[kept] = cloud->x[i];
+        cloud->y[kept] = cloud->y[i];
+        cloud->z[kept] = cloud->z[i];
+        cloud->red[kept] = cloud->red[i];
+        cloud->green[kept] = cloud->green[i];
+        cloud->blue[kept] = cloud->blue[i];
+        if (point_cloud_has_normals(cloud))
+        {
+            cloud->normal_x[kept] = cloud->normal_x[i];
+            cloud->normal_y[kept] = cloud->normal_y[i];
+            cloud->normal_z[kept] = cloud->normal_z[i];
+        }
+        kept++;
+    }
+    size_t removed = cloud->size - kept;
+    cloud->size = kept;
+    return removed;
+}
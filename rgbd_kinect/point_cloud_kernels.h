@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "point_cloud.h"
+#include "yuv_image.h"
+
+// Appends the pixels that have both depth (z != 0) and color (any BGRA byte != 0) to cloud, converting the BGR color
+// order of the image to RGB. xyz is the int16 point cloud image and bgra the color image in the same geometry. cloud
+// must have room for pixel_count more points. Returns the number of points appended. Uses AVX2 or SSE2 when the
+// build targets them.
+size_t point_cloud_extract(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count, point_cloud_t* cloud);
+
+// Number of points point_cloud_extract would append
+size_t point_cloud_count_valid(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count);
+
+// Appends the pixels begin to end of a row-major point cloud image that have depth, with their colors converted from
+// the YUV planes of the color image in the same geometry. xyz holds the points of those pixels, starting with pixel
+// begin. Decoded colors are never all zero, so unlike point_cloud_extract only the depth decides, and only the pixels
+// that become points are converted.
+size_t point_cloud_extract_yuv(const int16_t* xyz,
+    const yuv_planes_t* planes,
+    size_t begin,
+    size_t end,
+    point_cloud_t* cloud);
+
+// Removes the points of cloud from index first on whose z lies outside min_z to max_z, keeping the order of the rest.
+// Returns the number of points removed.
+size_t point_cloud_filter_depth_range(point_cloud_t* cloud, size_t first, int min_z, int max_z);
+
+// Number of pixels with depth, the number of points point_cloud_extract_yuv would append
+size_t point_cloud_count_valid_depth(const int16_t* xyz, size_t pixel_count);
+
+// Plain C++ versions of the kernels above, used for the tail of the image and to validate the vectorised paths
+size_t point_cloud_extract_scalar(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count, point_cloud_t* cloud);
+size_t point_cloud_count_valid_scalar(const int16_t* xyz, const uint8_t* bgra, size_t pixel_count);
@@ -0,0 +1,272 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "ray_table.h"
+#include "point_cloud.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAY_TABLE_SSE2
+#endif
+
+bool ray_table_create(const k4a_calibration_t* calibration, k4a_calibration_type_t camera, ray_table_t* table)
+{
+    memset(table, 0, sizeof(ray_table_t));
+    const k4a_calibration_camera_t* camera_calibration = camera == K4A_CALIBRATION_TYPE_DEPTH
+                                                             ? &calibration->depth_camera_calibration
+                                                             : &calibration->color_camera_calibration;
+    int width = camera_calibration->resolution_width;
+    int height = camera_calibration->resolution_height;
+
+    // one array per factor, each rounded up to whole cache lines so the next one stays aligned
+    size_t array_size = ((size_t)width * (size_t)height * sizeof(float) + POINT_CLOUD_ALIGNMENT - 1) /
+                        POINT_CLOUD_ALIGNMENT * POINT_CLOUD_ALIGNMENT;
+    uint8_t* allocation = (uint8_t*)aligned_buffer_allocate(3 * array_size);
+    if (allocation == NULL)
+    {
+        printf("Failed to allocate ray table\n");
+        return false;
+    }
+    table->width = width;
+    table->height = height;
+    table->x = (float*)(void*)allocation;
+    table->y = (float*)(void*)(allocation + array_size);
+    table->z = (float*)(void*)(allocation + 2 * array_size);
+    table->allocation = allocation;
+
+    for (int v = 0; v < height; v++)
+    {
+        for (int u = 0; u < width; u++)
+        {
+            size_t i = (size_t)v * (size_t)width + (size_t)u;
+            k4a_float2_t pixel;
+            pixel.xy.x = (float)u;
+            pixel.xy.y = (float)v;
+            k4a_float3_t ray;
+            int valid = 0;
+            if (K4A_RESULT_SUCCEEDED ==
+                    k4a_calibration_2d_to_3d(calibration, &pixel, 1.f, camera, camera, &ray, &valid) &&
+                valid)
+            {
+                table->x[i] = ray.xyz.x;
+                table->y[i] = ray.xyz.y;
+                table->z[i] = 1.f;
+            }
+            else
+            {
+                table->x[i] = 0.f;
+                table->y[i] = 0.f;
+                table->z[i] = 0.f;
+            }
+        }
+    }
+    return true;
+}
+
+void ray_table_destroy(ray_table_t* table)
+{
+    aligned_buffer_free(table->allocation);
+    memset(table, 0, sizeof(ray_table_t));
+}
+
+// The SDK reinterprets depth as int16 and rounds with floor(v + 0.5). Values beyond the int16 range, which real depth
+// never produces, saturate like the packing in the SSE2 path.
+static inline int16_t ray_table_scale(float factor, int16_t depth)
+{
+    float value = floorf(factor * (float)depth + 0.5f);
+    return (int16_t)(value < -32768.f ? -32768.f : (value > 32767.f ? 32767.f : value));
+}
+
+// xyz receives the points of pixels begin to end, starting with pixel begin
+static void compute_pixels_scalar(const ray_table_t* table,
+    const uint16_t* depth,
+    size_t begin,
+    size_t end,
+    int16_t* xyz)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        int16_t z = (int16_t)depth[i];
+        int16_t* out = xyz + 3 * (i - begin);
+        out[0] = ray_table_scale(table->x[i], z);
+        out[1] = ray_table_scale(table->y[i], z);
+        out[2] = ray_table_scale(table->z[i], z);
+    }
+}
+
+void ray_table_compute_rows_scalar(const ray_table_t* table,
+    const uint16_t* depth,
+    int row_begin,
+    int row_end,
+    int16_t* xyz)
+{
+    size_t begin = (size_t)row_begin * (size_t)table->width;
+    compute_pixels_scalar(table, depth, begin, (size_t)row_end * (size_t)table->width, xyz + 3 * begin);
+}
+
+#ifdef RAY_TABLE_SSE2
+
+// floor(factor * depth + 0.5) for four pixels. SSE2 has no floor, so the truncated value is corrected where
+// truncation rounded a negative value up.
+static inline __m128i scale_4(const float* factor, __m128 depth)
+{
+    __m128 value = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(factor), depth), _mm_set1_ps(0.5f));
+    __m128i truncated = _mm_cvttps_epi32(value);
+    __m128 rounded_up = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), value);
+    return _mm_add_epi32(truncated, _mm_castps_si128(rounded_up));
+}
+
+#endif
+
+void ray_table_compute_pixels(const ray_table_t* table,
+    const uint16_t* depth,
+    size_t begin,
+    size_t end,
+    int16_t* xyz)
+{
+    size_t i = begin;
+#ifdef RAY_TABLE_SSE2
+    for (; i + 8 <= end; i += 8)
+    {
+        // sign extend the depth like the int16 cast of the SDK, then convert four pixels at a time
+        __m128i depth_16 = _mm_loadu_si128((const __m128i*)(depth + i));
+        __m128 depth_low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(depth_16, depth_16), 16));
+        __m128 depth_high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(depth_16, depth_16), 16));
+
+        __m128i x = _mm_packs_epi32(scale_4(table->x + i, depth_low), scale_4(table->x + i + 4, depth_high));
+        __m128i y = _mm_packs_epi32(scale_4(table->y + i, depth_low), scale_4(table->y + i + 4, depth_high));
+        __m128i z = _mm_packs_epi32(scale_4(table->z + i, depth_low), scale_4(table->z + i + 4, depth_high));
+
+        // interleave into the x, y, z triplets of the point cloud image
+        int16_t planar[3][8];
+        _mm_storeu_si128((__m128i*)planar[0], x);
+        _mm_storeu_si128((__m128i*)planar[1], y);
+        _mm_storeu_si128((__m128i*)planar[2], z);
+        int16_t* out = xyz + 3 * (i - begin);
+        for (int k = 0; k < 8; k++)
+        {
+            out[3 * k + 0] = planar[0][k];
+            out[3 * k + 1] = planar[1][k];
+            out[3 * k + 2] = planar[2][k];
+        }
+    }
+#endif
+    compute_pixels_scalar(table, depth, i, end, xyz + 3 * (i - begin));
+}
+
+void ray_table_compute_rows(const ray_table_t* table,
+    const uint16_t* depth,
+    int row_begin,
+    int row_end,
+    int16_t* xyz)
+{
+    size_t begin = (size_t)row_begin * (size_t)table->width;
+    ray_table_compute_pixels(table, depth, begin, (size_t)row_end * (size_t)table->width, xyz + 3 * begin);
+}
+
+bool ray_table_depth_image_to_point_cloud(const ray_table_t* table,
+    const k4a_image_t depth_image,
+    k4a_image_t point_cloud_image)
+{
+    if (k4a_image_get_width_pixels(depth_image) != table->width ||
+        k4a_image_get_height_pixels(depth_image) != table->height ||
+        k4a_image_get_width_pixels(point_cloud_image) != table->width ||
+        k4a_image_get_height_pixels(point_cloud_image) != table->height)
+    {
+        printf("Depth image does not match the ray table\n");
+        return false;
+    }
+
+    ray_table_compute_rows(table,
+        (const uint16_t*)(void*)k4a_image_get_buffer(depth_image),
+        0,
+        table->height,
+        (int16_t*)(void*)k4a_image_get_buffer(point_cloud_image));
+    return true;
+}
+
+bool ray_table_validate(const ray_table_t* table, k4a_transformation_t transformation, k4a_calibration_type_t camera)
+{
+    k4a_image_t depth_image = NULL;
+    k4a_image_t table_point_cloud = NULL;
+    k4a_image_t sdk_point_cloud = NULL;
+    bool valid = false;
+    int max_difference = 0;
+
+    if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_DEPTH16,
+        table->width,
+        table->height,
+        table->width * (int)sizeof(uint16_t),
+        &depth_image) ||
+        K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM,
+        table->width,
+        table->height,
+        table->width * 3 * (int)sizeof(int16_t),
+        &table_point_cloud) ||
+        K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_CUSTOM,
+        table->width,
+        table->height,
+        table->width * 3 * (int)sizeof(int16_t),
+        &sdk_point_cloud))
+    {
+        printf("Failed to create ray table validation images\n");
+        goto exit;
+    }
+
+    {
+        // every pixel gets a different depth, sweeping the sensor range several times across the image
+        uint16_t* depth = (uint16_t*)(void*)k4a_image_get_buffer(depth_image);
+        size_t pixel_count = (size_t)table->width * (size_t)table->height;
+        for (size_t i = 0; i < pixel_count; i++)
+        {
+            depth[i] = (uint16_t)(i * 7919 % 12000);
+        }
+    }
+
+    if (K4A_RESULT_SUCCEEDED !=
+        k4a_transformation_depth_image_to_point_cloud(transformation, depth_image, camera, sdk_point_cloud))
+    {
+        printf("Failed to compute validation point cloud\n");
+        goto exit;
+    }
+    if (!ray_table_depth_image_to_point_cloud(table, depth_image, table_point_cloud))
+    {
+        goto exit;
+    }
+
+    {
+        const int16_t* expected = (const int16_t*)(void*)k4a_image_get_buffer(sdk_point_cloud);
+        const int16_t* actual = (const int16_t*)(void*)k4a_image_get_buffer(table_point_cloud);
+        size_t value_count = 3 * (size_t)table->width * (size_t)table->height;
+        for (size_t i = 0; i < value_count; i++)
+        {
+            int difference = abs((int)expected[i] - (int)actual[i]);
+            max_difference = difference > max_difference ? difference : max_difference;
+        }
+    }
+    valid = max_difference <= RAY_TABLE_TOLERANCE_MM;
+    if (!valid)
+    {
+        printf("Ray table differs from the SDK point cloud by up to %d mm\n", max_difference);
+    }
+
+exit:
+    if (depth_image != NULL)
+    {
+        k4a_image_release(depth_image);
+    }
+    if (table_point_cloud != NULL)
+    {
+        k4a_image_release(table_point_cloud);
+    }
+    if (sdk_point_cloud != NULL)
+    {
+        k4a_image_release(sdk_point_cloud);
+    }
+    return valid;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <k4a/k4a.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest difference in millimetres between a ray table point cloud and the SDK's that ray_table_validate accepts.
+// Both round x * depth to the nearest millimetre, a table built through a different code path can land on the other
+// side of a rounding tie.
+#define RAY_TABLE_TOLERANCE_MM 1
+
+// Ray through every pixel of one camera, built once per calibration the way the SDK's fastpointcloud example does:
+// the point seen by pixel i at depth d is (x[i] * d, y[i] * d, z[i] * d). Pixels outside the lens model have all
+// three factors 0, so they produce the zero point the SDK writes for them. Each array starts on a
+// POINT_CLOUD_ALIGNMENT boundary.
+struct ray_table_t
+{
+    int width;
+    int height;
+    float* x;
+    float* y;
+    float* z;
+    void* allocation; // single block backing the three arrays
+};
+
+// Unprojects every pixel of camera (depth or color) of calibration at unit depth
+bool ray_table_create(const k4a_calibration_t* calibration, k4a_calibration_type_t camera, ray_table_t* table);
+
+void ray_table_destroy(ray_table_t* table);
+
+// Computes rows row_begin to row_end of an int16 point cloud image in the K4A layout from a depth image of the
+// table's size, the same result as k4a_transformation_depth_image_to_point_cloud. depth and xyz point at the start
+// of the whole images. Uses SSE2 when the build targets it.
+void ray_table_compute_rows(const ray_table_t* table,
+    const uint16_t* depth,
+    int row_begin,
+    int row_end,
+    int16_t* xyz);
+
+// Computes the points of pixels begin to end into xyz, which starts with the point of pixel begin. Lets a caller
+// compute a small tile of points into a buffer that stays in cache instead of a whole point cloud image.
+void ray_table_compute_pixels(const ray_table_t* table,
+    const uint16_t* depth,
+    size_t begin,
+    size_t end,
+    int16_t* xyz);
+
+// Plain C++ version of ray_table_compute_rows, used for the tail of a row and to validate the vectorised path
+void ray_table_compute_rows_scalar(const ray_table_t* table,
+    const uint16_t* depth,
+    int row_begin,
+    int row_end,
+    int16_t* xyz);
+
+// Drop-in replacement for k4a_transformation_depth_image_to_point_cloud with a table of the depth image's camera
+bool ray_table_depth_image_to_point_cloud(const ray_table_t* table,
+    const k4a_image_t depth_image,
+    k4a_image_t point_cloud_image);
+
+// Computes the point cloud of a synthetic depth image covering the whole depth range with the table and with the SDK,
+// and checks that they agree within RAY_TABLE_TOLERANCE_MM
+bool ray_table_validate(const ray_table_t* table, k4a_transformation_t transformation, k4a_calibration_type_t camera);
@@ -0,0 +1,412 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "recording_index.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+
+// Gaps up to this many captures are read through, reading a capture costs less than a seek, which looks up the cues
+// and starts over at the beginning of a cluster
+static const size_t RECORDING_INDEX_READ_THROUGH = 4;
+
+static const char RECORDING_INDEX_MAGIC[8] = { 'K', '4', 'A', 'I', 'D', 'X', '0', '2' };
+
+// On-disk layout, little-endian: the header below, then entry_count entries of a uint64 position, uint64 depth position
+// and uint32 flags
+struct recording_index_header_t
+{
+    char magic[8];
+    uint64_t recording_size;
+    int64_t recording_write_time;
+    uint64_t start_offset_usec;
+    uint64_t entry_count;
+};
+
+static const size_t RECORDING_INDEX_ENTRY_SIZE = 2 * sizeof(uint64_t) + sizeof(uint32_t);
+
+std::string recording_index_path(const std::string& recording_path)
+{
+    return recording_path + ".k4aidx";
+}
+
+static bool recording_file_stamp(const std::string& recording_path, uint64_t* size, int64_t* write_time)
+{
+    std::error_code error;
+    *size = (uint64_t)std::filesystem::file_size(recording_path, error);
+    if (error)
+    {
+        return false;
+    }
+    *write_time = (int64_t)std::filesystem::last_write_time(recording_path, error).time_since_epoch().count();
+    return !error;
+}
+
+bool capture_earliest_timestamp(k4a_capture_t capture, uint64_t* timestamp_usec)
+{
+    k4a_image_t images[] = { k4a_capture_get_color_image(capture),
+                             k4a_capture_get_depth_image(capture),
+                             k4a_capture_get_ir_image(capture) };
+    bool found = false;
+    for (k4a_image_t image : images)
+    {
+        if (image == NULL)
+        {
+            continue;
+        }
+        uint64_t timestamp = k4a_image_get_device_timestamp_usec(image);
+        if (!found || timestamp < *timestamp_usec)
+        {
+            *timestamp_usec = timestamp;
+        }
+        found = true;
+        k4a_image_release(image);
+    }
+    return found;
+}
+
+// Position of capture from the start of the recording, the way the index records it
+static uint64_t capture_index_position(k4a_capture_t capture, uint64_t start_offset_usec)
+{
+    uint64_t timestamp_usec = 0;
+    if (capture_earliest_timestamp(capture, &timestamp_usec) && timestamp_usec > start_offset_usec)
+    {
+        return timestamp_usec - start_offset_usec;
+    }
+    return 0;
+}
+
+bool recording_find_first_complete(k4a_playback_t playback, uint64_t* position_usec)
+{
+    k4a_record_configuration_t record_configuration;
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_get_record_configuration(playback, &record_configuration) ||
+        K4A_RESULT_SUCCEEDED != k4a_playback_seek_timestamp(playback, 0, K4A_PLAYBACK_SEEK_BEGIN))
+    {
+        printf("failed to prepare scanning the recording\n");
+        return false;
+    }
+
+    for (;;)
+    {
+        k4a_capture_t capture = NULL;
+        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(playback, &capture);
+        if (stream_result == K4A_STREAM_RESULT_EOF)
+        {
+            return false;
+        }
+        if (stream_result != K4A_STREAM_RESULT_SUCCEEDED || capture == NULL)
+        {
+            printf("Failed to read capture from recording while scanning\n");
+            return false;
+        }
+
+        k4a_image_t color_image = k4a_capture_get_color_image(capture);
+        k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+        bool complete = color_image != NULL && depth_image != NULL;
+        uint64_t timestamp_usec = 0;
+        *position_usec = 0;
+        if (complete && capture_earliest_timestamp(capture, &timestamp_usec) &&
+            timestamp_usec > record_configuration.start_timestamp_offset_usec)
+        {
+            *position_usec = timestamp_usec - record_configuration.start_timestamp_offset_usec;
+        }
+        if (color_image != NULL)
+        {
+            k4a_image_release(color_image);
+        }
+        if (depth_image != NULL)
+        {
+            k4a_image_release(depth_image);
+        }
+        k4a_capture_release(capture);
+        if (complete)
+        {
+            return true;
+        }
+    }
+}
+
+bool recording_index_first_complete(const recording_index_t* index, uint64_t* position_usec)
+{
+    const uint32_t complete = RECORDING_INDEX_HAS_COLOR | RECORDING_INDEX_HAS_DEPTH;
+    for (const recording_index_entry_t& entry : index->entries)
+    {
+        if ((entry.flags & complete) == complete)
+        {
+            *position_usec = entry.position_usec;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool recording_index_build(const std::string& recording_path, k4a_playback_t playback, recording_index_t* index)
+{
+    k4a_record_configuration_t record_configuration;
+    if (!recording_file_stamp(recording_path, &index->recording_size, &index->recording_write_time) ||
+        K4A_RESULT_SUCCEEDED != k4a_playback_get_record_configuration(playback, &record_configuration) ||
+        K4A_RESULT_SUCCEEDED != k4a_playback_seek_timestamp(playback, 0, K4A_PLAYBACK_SEEK_BEGIN))
+    {
+        printf("failed to prepare indexing %s\n", recording_path.c_str());
+        return false;
+    }
+    index->start_offset_usec = record_configuration.start_timestamp_offset_usec;
+    index->entries.clear();
+
+    for (;;)
+    {
+        k4a_capture_t capture = NULL;
+        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(playback, &capture);
+        if (stream_result == K4A_STREAM_RESULT_EOF)
+        {
+            break;
+        }
+        if (stream_result != K4A_STREAM_RESULT_SUCCEEDED || capture == NULL)
+        {
+            printf("Failed to read capture from recording while indexing\n");
+            return false;
+        }
+
+        // every capture gets an entry, even one without images, so entry i is always the i-th capture read
+        recording_index_entry_t entry = {};
+        entry.position_usec = capture_index_position(capture, index->start_offset_usec);
+        k4a_image_t color_image = k4a_capture_get_color_image(capture);
+        k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+        if (color_image != NULL)
+        {
+            entry.flags |= RECORDING_INDEX_HAS_COLOR;
+            k4a_image_release(color_image);
+        }
+        if (depth_image != NULL)
+        {
+            entry.flags |= RECORDING_INDEX_HAS_DEPTH;
+            uint64_t timestamp_usec = k4a_image_get_device_timestamp_usec(depth_image);
+            if (timestamp_usec > index->start_offset_usec)
+            {
+                entry.depth_position_usec = timestamp_usec - index->start_offset_usec;
+            }
+            k4a_image_release(depth_image);
+        }
+        k4a_capture_release(capture);
+        index->entries.push_back(entry);
+    }
+    return true;
+}
+
+bool recording_index_save(const recording_index_t* index, const std::string& index_path)
+{
+    FILE* file = fopen(index_path.c_str(), "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    recording_index_header_t header = {};
+    memcpy(header.magic, RECORDING_INDEX_MAGIC, sizeof(header.magic));
+    header.recording_size = index->recording_size;
+    header.recording_write_time = index->recording_write_time;
+    header.start_offset_usec = index->start_offset_usec;
+    header.entry_count = index->entries.size();
+    bool succeeded = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // packed, without the padding of recording_index_entry_t
+    std::vector<uint8_t> packed(index->entries.size() * RECORDING_INDEX_ENTRY_SIZE);
+    for (size_t i = 0; i < index->entries.size(); i++)
+    {
+        uint8_t* packed_entry = &packed[i * RECORDING_INDEX_ENTRY_SIZE];
+        memcpy(packed_entry, &index->entries[i].position_usec, sizeof(uint64_t));
+        memcpy(packed_entry + sizeof(uint64_t), &index->entries[i].depth_position_usec, sizeof(uint64_t));
+        memcpy(packed_entry + 2 * sizeof(uint64_t), &index->entries[i].flags, sizeof(uint32_t));
+    }
+    succeeded = succeeded && (packed.empty() || fwrite(packed.data(), packed.size(), 1, file) == 1);
+    succeeded = fclose(file) == 0 && succeeded;
+    if (!succeeded)
+    {
+        // a partial sidecar would fail to load anyway, but it is better not to leave it around
+        remove(index_path.c_str());
+    }
+    return succeeded;
+}
+
+bool recording_index_load(const std::string& index_path, recording_index_t* index)
+{
+    FILE* file = fopen(index_path.c_str(), "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    bool succeeded = false;
+    recording_index_header_t header;
+    std::vector<uint8_t> packed;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, RECORDING_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.entry_count > std::numeric_limits<size_t>::max() / RECORDING_INDEX_ENTRY_SIZE)
+    {
+        goto exit;
+    }
+    packed.resize((size_t)header.entry_count * RECORDING_INDEX_ENTRY_SIZE);
+    if (!packed.empty() && fread(packed.data(), packed.size(), 1, file) != 1)
+    {
+        goto exit;
+    }
+
+    index->recording_size = header.recording_size;
+    index->recording_write_time = header.recording_write_time;
+    index->start_offset_usec = header.start_offset_usec;
+    index->entries.resize((size_t)header.entry_count);
+    for (size_t i = 0; i < index->entries.size(); i++)
+    {
+        const uint8_t* packed_entry = &packed[i * RECORDING_INDEX_ENTRY_SIZE];
+        memcpy(&index->entries[i].position_usec, packed_entry, sizeof(uint64_t));
+        memcpy(&index->entries[i].depth_position_usec, packed_entry + sizeof(uint64_t), sizeof(uint64_t));
+        memcpy(&index->entries[i].flags, packed_entry + 2 * sizeof(uint64_t), sizeof(uint32_t));
+    }
+    succeeded = true;
+
+exit:
+    fclose(file);
+    return succeeded;
+}
+
+bool recording_index_open(const std::string& recording_path, k4a_playback_t playback, recording_index_t* index)
+{
+    std::string index_path = recording_index_path(recording_path);
+    uint64_t size = 0;
+    int64_t write_time = 0;
+    if (recording_index_load(index_path, index) && recording_file_stamp(recording_path, &size, &write_time) &&
+        index->recording_size == size && index->recording_write_time == write_time)
+    {
+        return true;
+    }
+
+    printf("indexing %s\n", recording_path.c_str());
+    if (!recording_index_build(recording_path, playback, index))
+    {
+        return false;
+    }
+    if (!recording_index_save(index, index_path))
+    {
+        printf("could not save %s, the index is only kept for this run\n", index_path.c_str());
+    }
+    return true;
+}
+
+std::vector<size_t> recording_index_select(const recording_index_t* index,
+    uint64_t begin_usec,
+    uint64_t end_usec,
+    size_t stride)
+{
+    const uint32_t complete = RECORDING_INDEX_HAS_COLOR | RECORDING_INDEX_HAS_DEPTH;
+    std::vector<size_t> selection;
+    size_t complete_count = 0;
+    for (size_t i = 0; i < index->entries.size(); i++)
+    {
+        const recording_index_entry_t& entry = index->entries[i];
+        if ((entry.flags & complete) != complete || entry.depth_position_usec < begin_usec)
+        {
+            continue;
+        }
+        if (end_usec > 0 && entry.depth_position_usec >= end_usec)
+        {
+            break;
+        }
+        if (complete_count++ % (stride > 0 ? stride : 1) == 0)
+        {
+            selection.push_back(i);
+        }
+    }
+    return selection;
+}
+
+indexed_capture_reader::indexed_capture_reader(k4a_playback_t playback,
+    const recording_index_t* index,
+    std::vector<size_t> selection) :
+    m_playback(playback),
+    m_index(index),
+    m_selection(std::move(selection)),
+    m_position(std::numeric_limits<size_t>::max())
+{
+}
+
+bool indexed_capture_reader::seek(size_t entry)
+{
+    m_seek_count++;
+    m_position = std::numeric_limits<size_t>::max();
+    if (K4A_RESULT_SUCCEEDED != k4a_playback_seek_timestamp(m_playback,
+        (int64_t)m_index->entries[entry].position_usec,
+        K4A_PLAYBACK_SEEK_BEGIN))
+    {
+        printf("failed to seek to capture %zu\n", entry);
+        return false;
+    }
+    return true;
+}
+
+k4a_stream_result_t indexed_capture_reader::next(k4a_capture_t* capture)
+{
+    if (m_next_selected >= m_selection.size())
+    {
+        return K4A_STREAM_RESULT_EOF;
+    }
+    size_t target = m_selection[m_next_selected++];
+    uint64_t target_timestamp_usec = m_index->start_offset_usec + m_index->entries[target].position_usec;
+
+    // read through short gaps forward, seek over anything else
+    bool sought = false;
+    if (m_position > target || target - m_position > RECORDING_INDEX_READ_THROUGH)
+    {
+        if (!seek(target))
+        {
+            return K4A_STREAM_RESULT_FAILED;
+        }
+        sought = true;
+    }
+    for (;;)
+    {
+        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(m_playback, capture);
+        if (stream_result == K4A_STREAM_RESULT_EOF)
+        {
+            printf("recording ended before capture %zu of its index\n", target);
+            m_stale = true;
+            return K4A_STREAM_RESULT_FAILED;
+        }
+        if (stream_result != K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            return stream_result;
+        }
+        if (sought)
+        {
+            // A seek lands on the first capture with any image at or after the timestamp, which is the one before the
+            // target when one of its images was taken later than the earliest image of the target
+            uint64_t timestamp_usec = 0;
+            if (capture_earliest_timestamp(*capture, &timestamp_usec) && timestamp_usec < target_timestamp_usec)
+            {
+                k4a_capture_release(*capture);
+                *capture = NULL;
+                m_skipped_count++;
+                continue;
+            }
+            m_position = target;
+            sought = false;
+        }
+        if (m_position++ == target)
+        {
+            // a capture somewhere else than the index says means the recording has changed since it was indexed
+            if (capture_index_position(*capture, m_index->start_offset_usec) != m_index->entries[target].position_usec)
+            {
+                printf("capture %zu is not where its index puts it\n", target);
+                k4a_capture_release(*capture);
+                *capture = NULL;
+                m_stale = true;
+                return K4A_STREAM_RESULT_FAILED;
+            }
+            return K4A_STREAM_RESULT_SUCCEEDED;
+        }
+        k4a_capture_release(*capture);
+        *capture = NULL;
+        m_skipped_count++;
+    }
+}
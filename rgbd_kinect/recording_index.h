@@ -0,0 +1,108 @@
+#pragma once
+#include <k4a/k4a.h>
+#include <k4arecord/playback.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Sidecar index of the captures of a recording. Building it reads the recording once; afterwards the position and
+// contents of every capture are known without touching the recording, so a sparse selection of frames can seek
+// straight to each capture instead of reading through everything in between or seeking blindly and then reading
+// until a complete capture turns up.
+
+#define RECORDING_INDEX_HAS_COLOR 0x1u
+#define RECORDING_INDEX_HAS_DEPTH 0x2u
+
+struct recording_index_entry_t
+{
+    uint64_t position_usec;       // earliest image timestamp of the capture, from the start of the recording
+    uint64_t depth_position_usec; // depth image timestamp from the start of the recording, 0 without a depth image
+    uint32_t flags;               // RECORDING_INDEX_HAS_COLOR and RECORDING_INDEX_HAS_DEPTH
+};
+
+struct recording_index_t
+{
+    uint64_t recording_size;       // size and modification time of the recording the index was built from, a
+    int64_t recording_write_time;  // sidecar that no longer matches them is rebuilt
+    uint64_t start_offset_usec;    // device timestamp of the start of the recording
+    std::vector<recording_index_entry_t> entries;
+};
+
+// Sidecar file of the recording at recording_path
+std::string recording_index_path(const std::string& recording_path);
+
+// Builds the index by reading every capture of playback from the start. Leaves the playback position at the end.
+bool recording_index_build(const std::string& recording_path, k4a_playback_t playback, recording_index_t* index);
+
+bool recording_index_save(const recording_index_t* index, const std::string& index_path);
+
+// Fails if the file is missing, damaged or of another version
+bool recording_index_load(const std::string& index_path, recording_index_t* index);
+
+// Loads the sidecar of recording_path, or builds the index with playback and saves it if the sidecar is missing or
+// stale. Not being able to save the sidecar is not an error, the index is then only kept in memory.
+bool recording_index_open(const std::string& recording_path, k4a_playback_t playback, recording_index_t* index);
+
+// Entries of the captures with both a color and a depth image whose depth image is from begin_usec up to end_usec
+// (exclusive, 0 for the end of the recording), every stride-th of them. The range applies to the depth timestamp like
+// playback_range_t does, so reading with the selection gives the same frames as reading through the recording.
+std::vector<size_t> recording_index_select(const recording_index_t* index,
+    uint64_t begin_usec,
+    uint64_t end_usec,
+    size_t stride);
+
+// Reads a selection of the captures of an index from playback. Gaps of a few captures are read through, longer ones
+// are skipped with a seek to the exact timestamp of the next capture.
+class indexed_capture_reader
+{
+public:
+    // The playback position may be anywhere, the first capture is always sought
+    indexed_capture_reader(k4a_playback_t playback, const recording_index_t* index, std::vector<size_t> selection);
+
+    // Next selected capture, K4A_STREAM_RESULT_EOF after the last one. K4A_STREAM_RESULT_FAILED if reading failed or
+    // the recording no longer matches the index, see is_stale().
+    k4a_stream_result_t next(k4a_capture_t* capture);
+
+    // The recording ended early or a capture was not where the index puts it, the sidecar has to be rebuilt
+    bool is_stale() const
+    {
+        return m_stale;
+    }
+
+    size_t seek_count() const
+    {
+        return m_seek_count;
+    }
+
+    // Captures read and dropped on the way to a selected one
+    size_t skipped_count() const
+    {
+        return m_skipped_count;
+    }
+
+private:
+    bool seek(size_t entry);
+
+    k4a_playback_t m_playback;
+    const recording_index_t* m_index;
+    std::vector<size_t> m_selection;
+    size_t m_next_selected = 0;
+    size_t m_position;      // entry that k4a_playback_get_next_capture returns next, unknown before the first seek
+    size_t m_seek_count = 0;
+    size_t m_skipped_count = 0;
+    bool m_stale = false;
+};
+
+// Earliest device timestamp of the images of capture, false if it has none
+bool capture_earliest_timestamp(k4a_capture_t capture, uint64_t* timestamp_usec);
+
+// Position of the first capture with both a color and a depth image, from the start of the recording. Recordings
+// usually begin with depth-only captures while the color camera settles. The captures are read from the start but not
+// decoded, and the scan stops at the first complete one, which leaves the playback position right after it. False if
+// the recording has no complete capture.
+bool recording_find_first_complete(k4a_playback_t playback, uint64_t* position_usec);
+
+// The same from an index, without reading the recording
+bool recording_index_first_complete(const recording_index_t* index, uint64_t* position_usec);
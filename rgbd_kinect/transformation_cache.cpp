@@ -0,0 +1,105 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "transformation_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct transformation_cache_entry_t
+{
+    k4a_calibration_t calibration;
+    std::vector<k4a_transformation_t> transformations; // by slot, NULL where the slot has not asked yet
+};
+
+static std::mutex g_transformation_cache_mutex;
+// Keyed by the hash of the calibration, colliding calibrations share a bucket and are told apart by memcmp
+static std::unordered_multimap<uint64_t, transformation_cache_entry_t> g_transformation_cache;
+
+// FNV-1a over the bytes of the calibration. k4a_calibration_t only holds 4 byte members and has no padding, so equal
+// contents always give equal bytes.
+static uint64_t calibration_hash(const k4a_calibration_t* calibration)
+{
+    const uint8_t* bytes = (const uint8_t*)calibration;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(k4a_calibration_t); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Entry of calibration, NULL if there is none yet. Called with the cache mutex held.
+static transformation_cache_entry_t* find_entry(uint64_t hash, const k4a_calibration_t* calibration)
+{
+    auto range = g_transformation_cache.equal_range(hash);
+    for (auto entry = range.first; entry != range.second; ++entry)
+    {
+        if (memcmp(&entry->second.calibration, calibration, sizeof(k4a_calibration_t)) == 0)
+        {
+            return &entry->second;
+        }
+    }
+    return NULL;
+}
+
+k4a_transformation_t transformation_cache_get(const k4a_calibration_t* calibration, size_t slot)
+{
+    uint64_t hash = calibration_hash(calibration);
+    {
+        std::lock_guard<std::mutex> lock(g_transformation_cache_mutex);
+        transformation_cache_entry_t* entry = find_entry(hash, calibration);
+        if (entry != NULL && slot < entry->transformations.size() && entry->transformations[slot] != NULL)
+        {
+            return entry->transformations[slot];
+        }
+    }
+
+    // Created outside the lock, so the slots of a pool that start on a new calibration together create their handles
+    // in parallel instead of one after the other
+    k4a_transformation_t transformation = k4a_transformation_create(calibration);
+    if (transformation == NULL)
+    {
+        printf("Failed to create transformation\n");
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(g_transformation_cache_mutex);
+    transformation_cache_entry_t* entry = find_entry(hash, calibration);
+    if (entry == NULL)
+    {
+        entry = &g_transformation_cache.insert({ hash, { *calibration, {} } })->second;
+    }
+    if (slot >= entry->transformations.size())
+    {
+        entry->transformations.resize(slot + 1, NULL);
+    }
+    if (entry->transformations[slot] != NULL)
+    {
+        // another thread asked for the same slot meanwhile, its handle is the one everybody else already has
+        k4a_transformation_destroy(transformation);
+        return entry->transformations[slot];
+    }
+    entry->transformations[slot] = transformation;
+    return transformation;
+}
+
+void transformation_cache_clear()
+{
+    std::lock_guard<std::mutex> lock(g_transformation_cache_mutex);
+    for (auto& entry : g_transformation_cache)
+    {
+        for (k4a_transformation_t transformation : entry.second.transformations)
+        {
+            if (transformation != NULL)
+            {
+                k4a_transformation_destroy(transformation);
+            }
+        }
+    }
+    g_transformation_cache.clear();
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <k4a/k4a.h>
+#include <stddef.h>
+
+// Process-wide cache of transformation handles. Creating a handle precomputes tables for the whole depth and color
+// images, which takes tens of milliseconds, so every calibration with identical contents (the same device, scale and
+// crop) shares its handles however often and from however many places they are requested.
+//
+// A handle keeps scratch buffers of its own for every transformation, so it must never be used by two threads at
+// once. The cache therefore keeps one handle per calibration and slot: code that transforms on several threads passes
+// the slot of the thread, like the slot of a work_stealing_pool task or the index of a pipeline transform thread, and
+// single-threaded code uses slot 0. Threads that run at the same time must use different slots.
+
+// Transformation handle of slot for calibration, created on the first request for that calibration and slot. The
+// cache owns the handle, callers must not destroy it. Returns NULL if the handle could not be created. Thread-safe.
+k4a_transformation_t transformation_cache_get(const k4a_calibration_t* calibration, size_t slot = 0);
+
+// Destroys every cached handle, none of them may still be in use
+void transformation_cache_clear();
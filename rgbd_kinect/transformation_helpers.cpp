@@ -2,84 +2,547 @@
 // Licensed under the MIT License.
 
 #include "transformation_helpers.h"
+#include "image_kernels.h"
+#include "mapped_file.h"
+#include "point_cloud.h"
+#include "point_cloud_kernels.h"
+#include "work_stealing_pool.h"
+#include "yuv_image.h"
 
-#include <iostream>
-#include <fstream>
-#include <sstream>
-
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <string>
 #include <vector>
 
-struct color_point_t
+#define PLY_START_HEADER "ply"
+#define PLY_END_HEADER "end_header"
+#define PLY_ASCII "format ascii 1.0"
+#define PLY_BINARY_LITTLE_ENDIAN "format binary_little_endian 1.0"
+#define PLY_ELEMENT_VERTEX "element vertex"
+
+// The vertex count is only known once the body has been streamed out, so the header reserves a fixed number of
+// characters for it and the final value is patched in place. Ten digits cover any int32 pixel count.
+#define PLY_VERTEX_COUNT_WIDTH 10
+
+// Size of the staging buffer vertex records are serialised into before they are handed to the file
+#define PLY_WRITE_BUFFER_SIZE (32 * 1024)
+
+// Binary vertex record: int16 x, y, z and uint8 red, green, blue
+#define PLY_BINARY_VERTEX_SIZE (3 * sizeof(int16_t) + 3 * sizeof(uint8_t))
+
+// Longest serialised vertex: six signed 16 bit values, separators and the newline
+#define PLY_MAX_VERTEX_SIZE (6 * 7)
+
+// Number of points extracted and serialised at a time, small enough for the serialised block to always fit the
+// staging buffer so the arrays of a block stay in cache between the two steps
+#define PLY_BLOCK_POINT_COUNT (PLY_WRITE_BUFFER_SIZE / PLY_MAX_VERTEX_SIZE)
+
+// Upper bound of the PLY header, which is built on the stack
+#define PLY_MAX_HEADER_SIZE 512
+
+// Rows serialised by one task of the parallel writer, enough bands for stealing to even out dense and empty parts of
+// the image while keeping the number of band buffers small
+#define PLY_BAND_ROWS 16
+
+static inline char* append_int(char* out, int value)
+{
+    // std::to_chars is locale independent and never allocates, which also makes it safe to run on several threads
+    return std::to_chars(out, out + 6, value).ptr;
+}
+
+static size_t int_length(int value)
 {
-    int16_t xyz[3];
-    uint8_t rgb[3];
+    size_t length = value < 0 ? 2 : 1;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    while (magnitude >= 10)
+    {
+        magnitude /= 10;
+        length++;
+    }
+    return length;
+}
+
+// Serialises every point of the cloud to out and returns the end of the written data. Only positions and colors are
+// written, the header declares no normals.
+static char* serialise_points(const point_cloud_t* cloud, ply_format_t format, char* out)
+{
+    if (format == PLY_FORMAT_BINARY_LITTLE_ENDIAN)
+    {
+        // All our targets are little-endian, which lets the values be copied as they are
+        for (size_t i = 0; i < cloud->size; i++)
+        {
+            memcpy(out + 0, &cloud->x[i], sizeof(int16_t));
+            memcpy(out + 2, &cloud->y[i], sizeof(int16_t));
+            memcpy(out + 4, &cloud->z[i], sizeof(int16_t));
+            out[6] = (char)cloud->red[i];
+            out[7] = (char)cloud->green[i];
+            out[8] = (char)cloud->blue[i];
+            out += PLY_BINARY_VERTEX_SIZE;
+        }
+        return out;
+    }
+
+    // The coordinates are whole millimetres, so integer formatting prints exactly what the float conversion did
+    for (size_t i = 0; i < cloud->size; i++)
+    {
+        out = append_int(out, cloud->x[i]);
+        *out++ = ' ';
+        out = append_int(out, cloud->y[i]);
+        *out++ = ' ';
+        out = append_int(out, cloud->z[i]);
+        *out++ = ' ';
+        out = append_int(out, cloud->red[i]);
+        *out++ = ' ';
+        out = append_int(out, cloud->green[i]);
+        *out++ = ' ';
+        out = append_int(out, cloud->blue[i]);
+        *out++ = '\n';
+    }
+    return out;
+}
+
+// Number of bytes serialise_points produces for the cloud
+static size_t serialised_size(const point_cloud_t* cloud, ply_format_t format)
+{
+    if (format == PLY_FORMAT_BINARY_LITTLE_ENDIAN)
+    {
+        return cloud->size * PLY_BINARY_VERTEX_SIZE;
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < cloud->size; i++)
+    {
+        size += int_length(cloud->x[i]) + int_length(cloud->y[i]) + int_length(cloud->z[i]) +
+                int_length(cloud->red[i]) + int_length(cloud->green[i]) + int_length(cloud->blue[i]) + 6;
+    }
+    return size;
+}
+
+// Builds the PLY header into header, which holds PLY_MAX_HEADER_SIZE bytes, and returns its length. The vertex count
+// is in a fixed-width field starting at *vertex_count_offset, so both output backends produce byte-identical files and
+// the streaming backend can patch the count in afterwards.
+static size_t build_ply_header(ply_format_t format,
+    size_t vertex_count,
+    char* header,
+    size_t* vertex_count_offset)
+{
+    // keep the native int16 millimetre coordinates in binary files, which avoids any conversion per vertex
+    const char* coordinate_type = format == PLY_FORMAT_BINARY_LITTLE_ENDIAN ? "short" : "float";
+    size_t length = (size_t)snprintf(header,
+        PLY_MAX_HEADER_SIZE,
+        "%s\n%s\n%s ",
+        PLY_START_HEADER,
+        format == PLY_FORMAT_BINARY_LITTLE_ENDIAN ? PLY_BINARY_LITTLE_ENDIAN : PLY_ASCII,
+        PLY_ELEMENT_VERTEX);
+    *vertex_count_offset = length;
+    length += (size_t)snprintf(header + length,
+        PLY_MAX_HEADER_SIZE - length,
+        "%-*zu\n"
+        "property %s x\nproperty %s y\nproperty %s z\n"
+        "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+        "%s\n",
+        PLY_VERTEX_COUNT_WIDTH,
+        vertex_count,
+        coordinate_type,
+        coordinate_type,
+        coordinate_type,
+        PLY_END_HEADER);
+    return length;
+}
+
+// Colors of the point cloud pixels, a BGRA32 image or, when bgra is NULL, a YUV image (see yuv_image.h)
+struct point_colors_t
+{
+    const uint8_t* bgra;
+    yuv_planes_t yuv;
 };
 
-void tranformation_helpers_write_point_cloud(const k4a_image_t point_cloud_image,
-    const k4a_image_t color_image,
-    const char* file_name)
+// The points being written and the filters applied to them. The points come from a point cloud image, or when xyz is
+// NULL are computed from a depth image with the ray table of its camera, one tile at a time.
+struct point_source_t
 {
-    std::vector<color_point_t> points;
+    const int16_t* xyz;
+    const uint16_t* depth;
+    const ray_table_t* rays;
+    point_colors_t colors;
+    bool filter_depth;
+    int min_z;
+    int max_z;
+};
 
-    int width = k4a_image_get_width_pixels(point_cloud_image);
-    int height = k4a_image_get_height_pixels(color_image);
+// Appends the valid points among pixels begin to end to cloud, xyz holds the points of those pixels
+static void extract_pixels(const int16_t* xyz, const point_colors_t& colors, int begin, int end, point_cloud_t* cloud)
+{
+    if (colors.bgra == NULL)
+    {
+        point_cloud_extract_yuv(xyz, &colors.yuv, (size_t)begin, (size_t)end, cloud);
+        return;
+    }
+    point_cloud_extract(xyz, colors.bgra + 4 * begin, (size_t)(end - begin), cloud);
+}
 
-    int16_t* point_cloud_image_data = (int16_t*)(void*)k4a_image_get_buffer(point_cloud_image);
-    uint8_t* color_image_data = k4a_image_get_buffer(color_image);
+// Appends the points among pixels begin to end that are valid and pass the filters to cloud
+static size_t extract_points(const point_source_t& source, int begin, int end, point_cloud_t* cloud)
+{
+    size_t first = cloud->size;
+    if (source.xyz != NULL)
+    {
+        extract_pixels(source.xyz + 3 * begin, source.colors, begin, end, cloud);
+    }
+    else
+    {
+        // the points only ever exist in this tile, which stays in L1 between being computed and extracted
+        int16_t tile[3 * PLY_BLOCK_POINT_COUNT];
+        for (int tile_begin = begin; tile_begin < end; tile_begin += PLY_BLOCK_POINT_COUNT)
+        {
+            int tile_end = std::min(tile_begin + PLY_BLOCK_POINT_COUNT, end);
+            ray_table_compute_pixels(source.rays, source.depth, (size_t)tile_begin, (size_t)tile_end, tile);
+            extract_pixels(tile, source.colors, tile_begin, tile_end, cloud);
+        }
+    }
+    if (source.filter_depth)
+    {
+        point_cloud_filter_depth_range(cloud, first, source.min_z, source.max_z);
+    }
+    return cloud->size - first;
+}
 
-    for (int i = 0; i < width * height; i++)
+// Number of points extract_points appends for the whole image, only available for an unfiltered point cloud image
+static size_t count_points(const point_source_t& source, int pixel_count)
+{
+    if (source.colors.bgra == NULL)
     {
-        color_point_t point;
-        point.xyz[0] = point_cloud_image_data[3 * i + 0];
-        point.xyz[1] = point_cloud_image_data[3 * i + 1];
-        point.xyz[2] = point_cloud_image_data[3 * i + 2];
-        if (point.xyz[2] == 0)
+        return point_cloud_count_valid_depth(source.xyz, (size_t)pixel_count);
+    }
+    return point_cloud_count_valid(source.xyz, source.colors.bgra, (size_t)pixel_count);
+}
+
+// Serialised vertices of one band of rows
+struct ply_band_t
+{
+    std::string data;
+    size_t vertex_count;
+    size_t offset; // position of the band in the body, the total size of the bands before it
+};
+
+// Working memory of the thread writing a frame, created by the first frame a thread writes and reused by every later
+// one. The pool threads and the threads calling the writers keep theirs for as long as they run.
+struct ply_thread_scratch_t
+{
+    point_cloud_t block = {}; // points being extracted and serialised
+    std::vector<ply_band_t> bands; // the bands of the frame the thread writes with write_point_cloud_parallel
+
+    ~ply_thread_scratch_t()
+    {
+        point_cloud_destroy(&block);
+    }
+};
+
+static thread_local ply_thread_scratch_t ply_scratch;
+
+// Extraction block of the calling thread, NULL if it cannot be allocated
+static point_cloud_t* thread_block()
+{
+    if (ply_scratch.block.allocation == NULL && !point_cloud_create(PLY_BLOCK_POINT_COUNT, false, &ply_scratch.block))
+    {
+        printf("Failed to allocate point cloud block\n");
+        return NULL;
+    }
+    return &ply_scratch.block;
+}
+
+static bool write_point_cloud_stream(const point_source_t& source,
+    int pixel_count,
+    const char* file_name,
+    ply_format_t format)
+{
+    point_cloud_t* block = thread_block();
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    direct_file_t file;
+    if (!direct_file_create(file_name, &file))
+    {
+        return false;
+    }
+
+    char header[PLY_MAX_HEADER_SIZE];
+    size_t vertex_count_offset = 0;
+    size_t header_size = build_ply_header(format, 0, header, &vertex_count_offset);
+    direct_file_write(&file, header, header_size);
+
+    char buffer[PLY_WRITE_BUFFER_SIZE];
+    size_t vertex_count = 0;
+    for (int begin = 0; begin < pixel_count; begin += PLY_BLOCK_POINT_COUNT)
+    {
+        int end = std::min(begin + PLY_BLOCK_POINT_COUNT, pixel_count);
+        block->size = 0;
+        extract_points(source, begin, end, block);
+        char* buffer_end = serialise_points(block, format, buffer);
+        direct_file_write(&file, buffer, (size_t)(buffer_end - buffer));
+        vertex_count += block->size;
+    }
+
+    char vertex_count_field[PLY_VERTEX_COUNT_WIDTH + 1];
+    snprintf(vertex_count_field, sizeof(vertex_count_field), "%-*zu", PLY_VERTEX_COUNT_WIDTH, vertex_count);
+    direct_file_write_at(&file, vertex_count_offset, vertex_count_field, PLY_VERTEX_COUNT_WIDTH);
+
+    if (!direct_file_close(&file))
+    {
+        printf("Failed to write point cloud to %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+static bool write_point_cloud_mapped(const point_source_t& source,
+    int pixel_count,
+    const char* file_name,
+    ply_format_t format)
+{
+    point_cloud_t* block = thread_block();
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    // The filter pass only reads the two images, which is far cheaper than formatting. Knowing the exact vertex count
+    // and body size lets the file be allocated once and the records be written straight into the page cache.
+    size_t vertex_count = 0;
+    size_t body_size = 0;
+    if (format == PLY_FORMAT_BINARY_LITTLE_ENDIAN && source.xyz != NULL && !source.filter_depth)
+    {
+        vertex_count = count_points(source, pixel_count);
+        body_size = vertex_count * PLY_BINARY_VERTEX_SIZE;
+    }
+    else
+    {
+        for (int begin = 0; begin < pixel_count; begin += PLY_BLOCK_POINT_COUNT)
         {
-            continue;
+            int end = std::min(begin + PLY_BLOCK_POINT_COUNT, pixel_count);
+            block->size = 0;
+            extract_points(source, begin, end, block);
+            vertex_count += block->size;
+            body_size += serialised_size(block, format);
         }
+    }
 
-        point.rgb[0] = color_image_data[4 * i + 0];
-        point.rgb[1] = color_image_data[4 * i + 1];
-        point.rgb[2] = color_image_data[4 * i + 2];
-        uint8_t alpha = color_image_data[4 * i + 3];
+    char header[PLY_MAX_HEADER_SIZE];
+    size_t vertex_count_offset = 0;
+    size_t header_size = build_ply_header(format, vertex_count, header, &vertex_count_offset);
 
-        if (point.rgb[0] == 0 && point.rgb[1] == 0 && point.rgb[2] == 0 && alpha == 0)
+    mapped_file_t mapped_file;
+    if (!mapped_file_create(file_name, header_size + body_size, &mapped_file))
+    {
+        return false;
+    }
+
+    memcpy(mapped_file.data, header, header_size);
+    char* out = (char*)mapped_file.data + header_size;
+    for (int begin = 0; begin < pixel_count; begin += PLY_BLOCK_POINT_COUNT)
+    {
+        int end = std::min(begin + PLY_BLOCK_POINT_COUNT, pixel_count);
+        block->size = 0;
+        extract_points(source, begin, end, block);
+        out = serialise_points(block, format, out);
+    }
+
+    if (!mapped_file_close(&mapped_file))
+    {
+        printf("Failed to write point cloud to %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+// Serialises one band of pixels with the extraction block of the calling thread. The band keeps the capacity of its
+// buffer from earlier frames, so once the bands have grown to their usual size nothing is allocated.
+static bool serialise_band(const point_source_t& source, int begin, int end, ply_format_t format, ply_band_t* band)
+{
+    point_cloud_t* block = thread_block();
+    if (block == NULL)
+    {
+        return false;
+    }
+    char buffer[PLY_WRITE_BUFFER_SIZE];
+    for (int block_begin = begin; block_begin < end; block_begin += PLY_BLOCK_POINT_COUNT)
+    {
+        int block_end = std::min(block_begin + PLY_BLOCK_POINT_COUNT, end);
+        block->size = 0;
+        extract_points(source, block_begin, block_end, block);
+        char* buffer_end = serialise_points(block, format, buffer);
+        band->data.append(buffer, (size_t)(buffer_end - buffer));
+        band->vertex_count += block->size;
+    }
+    return true;
+}
+
+// Bands of PLY_BAND_ROWS rows are extracted and serialised by the threads of pool, each into a buffer of its own. A
+// prefix sum over the band sizes then gives every band its place in the body, so the file is byte-identical to the
+// single threaded output no matter which thread ran which band.
+static bool write_point_cloud_parallel(const point_source_t& source,
+    int width,
+    int height,
+    const char* file_name,
+    ply_format_t format,
+    ply_output_t output,
+    work_stealing_pool* pool)
+{
+    // A pool loop only runs tasks of its own loop on the calling thread while it waits, so no other frame can reuse
+    // these bands before this one is written
+    std::vector<ply_band_t>& bands = ply_scratch.bands;
+    size_t band_count = (size_t)((height + PLY_BAND_ROWS - 1) / PLY_BAND_ROWS);
+    if (bands.size() < band_count)
+    {
+        bands.resize(band_count);
+    }
+    for (size_t b = 0; b < band_count; b++)
+    {
+        bands[b].data.clear();
+        bands[b].vertex_count = 0;
+    }
+
+    std::atomic<bool> allocated{ true };
+    pool->parallel_for(band_count, [&](size_t b, size_t /*slot*/) {
+        int row_begin = (int)b * PLY_BAND_ROWS;
+        int row_end = std::min(row_begin + PLY_BAND_ROWS, height);
+        if (!serialise_band(source, row_begin * width, row_end * width, format, &bands[b]))
         {
-            continue;
+            allocated.store(false);
         }
+    });
+    if (!allocated.load())
+    {
+        return false;
+    }
 
-        points.push_back(point);
+    size_t vertex_count = 0;
+    size_t body_size = 0;
+    for (size_t b = 0; b < band_count; b++)
+    {
+        bands[b].offset = body_size;
+        body_size += bands[b].data.size();
+        vertex_count += bands[b].vertex_count;
     }
 
-#define PLY_START_HEADER "ply"
-#define PLY_END_HEADER "end_header"
-#define PLY_ASCII "format ascii 1.0"
-#define PLY_ELEMENT_VERTEX "element vertex"
+    char header[PLY_MAX_HEADER_SIZE];
+    size_t vertex_count_offset = 0;
+    size_t header_size = build_ply_header(format, vertex_count, header, &vertex_count_offset);
+
+    if (output == PLY_OUTPUT_MEMORY_MAPPED)
+    {
+        mapped_file_t mapped_file;
+        if (!mapped_file_create(file_name, header_size + body_size, &mapped_file))
+        {
+            return false;
+        }
+        memcpy(mapped_file.data, header, header_size);
+        uint8_t* body = mapped_file.data + header_size;
+        pool->parallel_for(band_count, [&](size_t b, size_t) {
+            memcpy(body + bands[b].offset, bands[b].data.c_str(), bands[b].data.size());
+        });
+        if (!mapped_file_close(&mapped_file))
+        {
+            printf("Failed to write point cloud to %s\n", file_name);
+            return false;
+        }
+        return true;
+    }
+
+    direct_file_t file;
+    if (!direct_file_create(file_name, &file))
+    {
+        return false;
+    }
+    direct_file_write(&file, header, header_size);
+    for (size_t b = 0; b < band_count; b++)
+    {
+        direct_file_write(&file, bands[b].data.c_str(), bands[b].data.size());
+    }
+    if (!direct_file_close(&file))
+    {
+        printf("Failed to write point cloud to %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+// Fills in the colors and filters of source, the caller provides the points
+static void init_point_source(const k4a_image_t color_image, ply_write_options_t options, point_source_t* source)
+{
+    *source = {};
+    if (!yuv_image_get_planes(color_image, &source->colors.yuv))
+    {
+        source->colors.bgra = k4a_image_get_buffer(color_image);
+    }
+    source->filter_depth = options.min_depth_mm > 0 || options.max_depth_mm > 0;
+    source->min_z = options.min_depth_mm;
+    source->max_z = options.max_depth_mm > 0 ? options.max_depth_mm : INT16_MAX;
+}
 
-    // save to the ply file
-    std::ofstream ofs(file_name); // text mode first
-    ofs << PLY_START_HEADER << std::endl;
-    ofs << PLY_ASCII << std::endl;
-    ofs << PLY_ELEMENT_VERTEX << " " << points.size() << std::endl;
-    ofs << "property float x" << std::endl;
-    ofs << "property float y" << std::endl;
-    ofs << "property float z" << std::endl;
-    ofs << "property uchar red" << std::endl;
-    ofs << "property uchar green" << std::endl;
-    ofs << "property uchar blue" << std::endl;
-    ofs << PLY_END_HEADER << std::endl;
-    ofs.close();
+static bool write_point_cloud(const point_source_t& source,
+    int width,
+    int height,
+    const char* file_name,
+    ply_write_options_t options)
+{
+    if (options.pool != NULL && options.pool->slot_count() > 1)
+    {
+        return write_point_cloud_parallel(source,
+            width,
+            height,
+            file_name,
+            options.format,
+            options.output,
+            options.pool);
+    }
+    int pixel_count = width * height;
+    if (options.output == PLY_OUTPUT_MEMORY_MAPPED)
+    {
+        return write_point_cloud_mapped(source, pixel_count, file_name, options.format);
+    }
+    return write_point_cloud_stream(source, pixel_count, file_name, options.format);
+}
 
-    std::stringstream ss;
-    for (size_t i = 0; i < points.size(); ++i)
+bool tranformation_helpers_write_point_cloud(const k4a_image_t point_cloud_image,
+    const k4a_image_t color_image,
+    const char* file_name,
+    ply_write_options_t options)
+{
+    int width = k4a_image_get_width_pixels(point_cloud_image);
+    int height = k4a_image_get_height_pixels(color_image);
+
+    point_source_t source;
+    init_point_source(color_image, options, &source);
+    source.xyz = (const int16_t*)(void*)k4a_image_get_buffer(point_cloud_image);
+    return write_point_cloud(source, width, height, file_name, options);
+}
+
+bool tranformation_helpers_write_depth_point_cloud(const ray_table_t* rays,
+    const k4a_image_t depth_image,
+    const k4a_image_t color_image,
+    const char* file_name,
+    ply_write_options_t options)
+{
+    int width = k4a_image_get_width_pixels(depth_image);
+    int height = k4a_image_get_height_pixels(depth_image);
+    if (width != rays->width || height != rays->height || width != k4a_image_get_width_pixels(color_image) ||
+        height != k4a_image_get_height_pixels(color_image))
     {
-        // image data is BGR
-        ss << (float)points[i].xyz[0] << " " << (float)points[i].xyz[1] << " " << (float)points[i].xyz[2];
-        ss << " " << (float)points[i].rgb[2] << " " << (float)points[i].rgb[1] << " " << (float)points[i].rgb[0];
-        ss << std::endl;
+        printf("Depth image does not match the ray table and color image\n");
+        return false;
     }
-    std::ofstream ofs_text(file_name, std::ios::out | std::ios::app);
-    ofs_text.write(ss.str().c_str(), (std::streamsize)ss.str().length());
+
+    point_source_t source;
+    init_point_source(color_image, options, &source);
+    source.depth = (const uint16_t*)(void*)k4a_image_get_buffer(depth_image);
+    source.rays = rays;
+    return write_point_cloud(source, width, height, file_name, options);
 }
 
 k4a_image_t downscale_image_2x2_binning(const k4a_image_t color_image)
@@ -99,35 +562,16 @@ k4a_image_t downscale_image_2x2_binning(const k4a_image_t color_image)
         return color_image_downscaled;
     }
 
-    uint8_t* color_image_data = k4a_image_get_buffer(color_image);
+    const uint8_t* color_image_data = k4a_image_get_buffer(color_image);
+    int color_image_stride_bytes = k4a_image_get_stride_bytes(color_image);
     uint8_t* color_image_downscaled_data = k4a_image_get_buffer(color_image_downscaled);
+    int color_image_downscaled_stride_bytes = k4a_image_get_stride_bytes(color_image_downscaled);
     for (int j = 0; j < color_image_downscaled_height_pixels; j++)
     {
-        for (int i = 0; i < color_image_downscaled_width_pixels; i++)
-        {
-            int index_downscaled = j * color_image_downscaled_width_pixels + i;
-            int index_tl = (j * 2 + 0) * color_image_width_pixels + i * 2 + 0;
-            int index_tr = (j * 2 + 0) * color_image_width_pixels + i * 2 + 1;
-            int index_bl = (j * 2 + 1) * color_image_width_pixels + i * 2 + 0;
-            int index_br = (j * 2 + 1) * color_image_width_pixels + i * 2 + 1;
-
-            color_image_downscaled_data[4 * index_downscaled + 0] = (uint8_t)(
-                (color_image_data[4 * index_tl + 0] + color_image_data[4 * index_tr + 0] +
-                    color_image_data[4 * index_bl + 0] + color_image_data[4 * index_br + 0]) /
-                4.0f);
-            color_image_downscaled_data[4 * index_downscaled + 1] = (uint8_t)(
-                (color_image_data[4 * index_tl + 1] + color_image_data[4 * index_tr + 1] +
-                    color_image_data[4 * index_bl + 1] + color_image_data[4 * index_br + 1]) /
-                4.0f);
-            color_image_downscaled_data[4 * index_downscaled + 2] = (uint8_t)(
-                (color_image_data[4 * index_tl + 2] + color_image_data[4 * index_tr + 2] +
-                    color_image_data[4 * index_bl + 2] + color_image_data[4 * index_br + 2]) /
-                4.0f);
-            color_image_downscaled_data[4 * index_downscaled + 3] = (uint8_t)(
-                (color_image_data[4 * index_tl + 3] + color_image_data[4 * index_tr + 3] +
-                    color_image_data[4 * index_bl + 3] + color_image_data[4 * index_br + 3]) /
-                4.0f);
-        }
+        downscale_row_2x2_binning(color_image_data + (j * 2 + 0) * color_image_stride_bytes,
+            color_image_data + (j * 2 + 1) * color_image_stride_bytes,
+            color_image_downscaled_width_pixels,
+            color_image_downscaled_data + j * color_image_downscaled_stride_bytes);
     }
 
     return color_image_downscaled;
@@ -1,8 +1,52 @@
 #pragma once
 #include <k4a/k4a.h>
 
-void tranformation_helpers_write_point_cloud(const k4a_image_t point_cloud_image,
+#include "ray_table.h"
+
+class work_stealing_pool;
+
+// Encoding of the vertex data in the written PLY file
+typedef enum
+{
+    PLY_FORMAT_ASCII = 0,             // one text line per vertex, readable by every tool
+    PLY_FORMAT_BINARY_LITTLE_ENDIAN,  // packed 9 byte records (int16 xyz + uint8 rgb)
+} ply_format_t;
+
+// How the PLY file is put on disk
+typedef enum
+{
+    PLY_OUTPUT_STREAM = 0,     // stream through a small staging buffer, count patched into the header at the end
+    PLY_OUTPUT_MEMORY_MAPPED,  // count the points first, then size and map the file and serialise into the mapping
+} ply_output_t;
+
+typedef struct
+{
+    ply_format_t format;
+    ply_output_t output;
+    work_stealing_pool* pool;  // threads the file is serialised on in bands of rows, NULL writes on the calling thread
+    int min_depth_mm;          // points with a smaller z are left out
+    int max_depth_mm;          // points with a larger z are left out, 0 keeps every distance
+} ply_write_options_t;
+
+// Plain ASCII PLY of every point written through a stream, what tranformation_helpers_write_point_cloud always
+// produced
+static const ply_write_options_t PLY_WRITE_OPTIONS_INIT_DEFAULT = { PLY_FORMAT_ASCII, PLY_OUTPUT_STREAM, NULL, 0, 0 };
+
+// Writes the points that have both depth and color to a PLY file, encoded and put on disk as selected in options.
+// Returns false if the file could not be written.
+bool tranformation_helpers_write_point_cloud(const k4a_image_t point_cloud_image,
+    const k4a_image_t color_image,
+    const char* file_name,
+    ply_write_options_t options = PLY_WRITE_OPTIONS_INIT_DEFAULT);
+
+// Fused version of tranformation_helpers_write_point_cloud for a depth image in the geometry of color_image and the
+// ray table of that camera. Each small tile of pixels is turned into points, filtered and serialised while it is in
+// cache, so no point cloud image is ever written to memory. Produces the same file as computing the point cloud
+// image with ray_table_depth_image_to_point_cloud and writing that.
+bool tranformation_helpers_write_depth_point_cloud(const ray_table_t* rays,
+    const k4a_image_t depth_image,
     const k4a_image_t color_image,
-    const char* file_name);
+    const char* file_name,
+    ply_write_options_t options = PLY_WRITE_OPTIONS_INIT_DEFAULT);
 
 k4a_image_t downscale_image_2x2_binning(const k4a_image_t color_image);
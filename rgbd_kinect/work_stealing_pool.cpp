@@ -0,0 +1,190 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "work_stealing_pool.h"
+
+work_stealing_pool::work_stealing_pool(size_t worker_count)
+{
+    for (size_t w = 0; w < worker_count; w++)
+    {
+        m_workers.emplace_back(&work_stealing_pool::run, this, w + 1);
+    }
+}
+
+work_stealing_pool::~work_stealing_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work_available.notify_all();
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+
+    while (m_free_loops != nullptr)
+    {
+        loop_t* loop = m_free_loops;
+        m_free_loops = loop->next;
+        delete loop;
+    }
+}
+
+void work_stealing_pool::run_loop(size_t task_count, loop_body_t call, const void* body)
+{
+    if (task_count == 0)
+    {
+        return;
+    }
+
+    size_t slots = slot_count();
+    loop_t* loop;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        loop = acquire_loop();
+    }
+    loop->call = call;
+    loop->body = body;
+    for (size_t s = 0; s < slots; s++)
+    {
+        loop->ranges[s].begin = task_count * s / slots;
+        loop->ranges[s].end = task_count * (s + 1) / slots;
+    }
+
+    if (!m_workers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            loop->queued = true;
+            loop->next = nullptr;
+            loop->previous = m_last_loop;
+            if (m_last_loop != nullptr)
+            {
+                m_last_loop->next = loop;
+            }
+            else
+            {
+                m_first_loop = loop;
+            }
+            m_last_loop = loop;
+        }
+        m_work_available.notify_all();
+    }
+
+    run_tasks(loop, 0);
+
+    // every task has been taken, wait for the ones other threads are still running before the loop is reused
+    std::unique_lock<std::mutex> lock(m_mutex);
+    dequeue_loop(loop);
+    m_loop_released.wait(lock, [loop] { return loop->users == 0; });
+    loop->next = m_free_loops;
+    m_free_loops = loop;
+}
+
+work_stealing_pool::loop_t* work_stealing_pool::acquire_loop()
+{
+    loop_t* loop = m_free_loops;
+    if (loop != nullptr)
+    {
+        m_free_loops = loop->next;
+        return loop;
+    }
+
+    loop = new loop_t();
+    loop->ranges.reset(new task_range_t[slot_count()]);
+    loop->users = 0;
+    loop->queued = false;
+    return loop;
+}
+
+void work_stealing_pool::dequeue_loop(loop_t* loop)
+{
+    if (!loop->queued)
+    {
+        return;
+    }
+
+    if (loop->previous != nullptr)
+    {
+        loop->previous->next = loop->next;
+    }
+    else
+    {
+        m_first_loop = loop->next;
+    }
+    if (loop->next != nullptr)
+    {
+        loop->next->previous = loop->previous;
+    }
+    else
+    {
+        m_last_loop = loop->previous;
+    }
+    loop->queued = false;
+}
+
+void work_stealing_pool::run(size_t slot)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_work_available.wait(lock, [this] { return m_first_loop != nullptr || m_stopping; });
+        if (m_stopping)
+        {
+            break;
+        }
+
+        loop_t* loop = m_first_loop;
+        loop->users++;
+        lock.unlock();
+
+        run_tasks(loop, slot);
+
+        lock.lock();
+        // nothing is left to take, so no other worker needs to look at the loop again
+        dequeue_loop(loop);
+        loop->users--;
+        if (loop->users == 0)
+        {
+            m_loop_released.notify_all();
+        }
+    }
+}
+
+void work_stealing_pool::run_tasks(loop_t* loop, size_t slot)
+{
+    size_t slots = slot_count();
+    for (;;)
+    {
+        size_t task = 0;
+        bool found = false;
+        {
+            task_range_t& own = loop->ranges[slot];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.begin < own.end)
+            {
+                task = own.begin++;
+                found = true;
+            }
+        }
+
+        // steal from the back of the other ranges, starting with the next slot so thieves spread out
+        for (size_t k = 1; k < slots && !found; k++)
+        {
+            task_range_t& victim = loop->ranges[(slot + k) % slots];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.begin < victim.end)
+            {
+                task = --victim.end;
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            return;
+        }
+        loop->call(loop->body, task, slot);
+    }
+}
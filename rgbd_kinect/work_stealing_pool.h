@@ -0,0 +1,84 @@
+#pragma once
+#include <stddef.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that run parallel loops. Each loop starts with its tasks split into one contiguous range per
+// slot, a thread takes tasks from the front of its own range and, once that is empty, steals from the back of the
+// others, so uneven tasks still keep every thread busy. The calling thread runs tasks of its own loop as well.
+// Loops may be started from several threads at once and from inside a task. Loop descriptors are recycled, so once
+// the pool has seen as many loops at once as it will ever run, starting a loop allocates nothing.
+class work_stealing_pool
+{
+public:
+    // worker_count threads are started in addition to the threads that call parallel_for
+    explicit work_stealing_pool(size_t worker_count);
+
+    ~work_stealing_pool();
+
+    // Number of slots of every loop: the caller gets slot 0, worker w slot w + 1
+    size_t slot_count() const
+    {
+        return m_workers.size() + 1;
+    }
+
+    // Runs body(task, slot) for every task from 0 to task_count and returns once all of them have finished. No two
+    // tasks of the same loop run with the same slot at once, which lets body use per-slot scratch space. body is
+    // called through a plain function pointer, so unlike a std::function it is never copied to the heap.
+    template <typename body_t> void parallel_for(size_t task_count, const body_t& body)
+    {
+        run_loop(task_count, &call_body<body_t>, &body);
+    }
+
+private:
+    typedef void (*loop_body_t)(const void* body, size_t task, size_t slot);
+
+    // Tasks begin to end of one slot, the owner takes from begin and thieves from end
+    struct task_range_t
+    {
+        std::mutex mutex;
+        size_t begin;
+        size_t end;
+    };
+
+    // The loop list and the free list link the descriptors through next and previous, so neither allocates
+    struct loop_t
+    {
+        loop_body_t call;
+        const void* body;
+        std::unique_ptr<task_range_t[]> ranges; // one per slot
+        size_t users;   // workers currently running tasks of the loop, guarded by the pool mutex
+        bool queued;    // in the list of loops workers pick from
+        loop_t* next;
+        loop_t* previous;
+    };
+
+    template <typename body_t> static void call_body(const void* body, size_t task, size_t slot)
+    {
+        (*(const body_t*)body)(task, slot);
+    }
+
+    void run_loop(size_t task_count, loop_body_t call, const void* body);
+    void run(size_t slot);
+
+    // Free descriptor, or a new one if every descriptor is in use. Called with the pool mutex held.
+    loop_t* acquire_loop();
+    // Takes loop out of the list workers pick from, if it is still in it. Called with the pool mutex held.
+    void dequeue_loop(loop_t* loop);
+
+    // Runs tasks of loop as slot until there are none left to take
+    void run_tasks(loop_t* loop, size_t slot);
+
+    std::vector<std::thread> m_workers;
+    loop_t* m_first_loop = nullptr; // loops with tasks left, oldest first
+    loop_t* m_last_loop = nullptr;
+    loop_t* m_free_loops = nullptr;
+    std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_loop_released;
+    bool m_stopping = false;
+};
@@ -0,0 +1,47 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+#include "yuv_image.h"
+
+size_t yuv_image_size(int width, int height, int chroma_shift_x, int chroma_shift_y)
+{
+    size_t chroma_width = (size_t)((width + (1 << chroma_shift_x) - 1) >> chroma_shift_x);
+    size_t chroma_height = (size_t)((height + (1 << chroma_shift_y) - 1) >> chroma_shift_y);
+    return (size_t)width * (size_t)height + 2 * chroma_width * chroma_height;
+}
+
+bool yuv_image_get_planes(const k4a_image_t image, yuv_planes_t* planes)
+{
+    if (k4a_image_get_format(image) != K4A_IMAGE_FORMAT_CUSTOM)
+    {
+        return false;
+    }
+
+    int width = k4a_image_get_width_pixels(image);
+    int height = k4a_image_get_height_pixels(image);
+    size_t size = k4a_image_get_size(image);
+
+    // 4:4:4, 4:2:2 and 4:2:0 in that order, their sizes differ for any image larger than one pixel
+    static const int chroma_shifts[][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 } };
+    for (const int* shift : chroma_shifts)
+    {
+        if (yuv_image_size(width, height, shift[0], shift[1]) != size)
+        {
+            continue;
+        }
+
+        const uint8_t* buffer = k4a_image_get_buffer(image);
+        int chroma_width = (width + (1 << shift[0]) - 1) >> shift[0];
+        int chroma_height = (height + (1 << shift[1]) - 1) >> shift[1];
+        planes->y = buffer;
+        planes->u = buffer + (size_t)width * (size_t)height;
+        planes->v = planes->u + (size_t)chroma_width * (size_t)chroma_height;
+        planes->width = width;
+        planes->height = height;
+        planes->chroma_width = chroma_width;
+        planes->chroma_shift_x = shift[0];
+        planes->chroma_shift_y = shift[1];
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <k4a/k4a.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Decoded color images can be kept as planar YUV instead of BGRA32, so only the pixels that end up in a point cloud
+// pay for color conversion. Such an image is a K4A_IMAGE_FORMAT_CUSTOM image with the Y, U and V planes stored back
+// to back without row padding, the layout tjDecompressToYUV2 writes with pad 1. Chroma is either full resolution
+// (4:4:4), half width (4:2:2) or half width and height (4:2:0); the buffer size tells which.
+
+struct yuv_planes_t
+{
+    const uint8_t* y;
+    const uint8_t* u;
+    const uint8_t* v;
+    int width;
+    int height;
+    int chroma_width;   // row stride of the u and v planes
+    int chroma_shift_x; // log2 of the horizontal chroma subsampling
+    int chroma_shift_y; // log2 of the vertical chroma subsampling
+};
+
+// Buffer size of a width x height YUV image with the given chroma subsampling
+size_t yuv_image_size(int width, int height, int chroma_shift_x, int chroma_shift_y);
+
+// Fills planes from a YUV image, false if the image is not laid out as described above
+bool yuv_image_get_planes(const k4a_image_t image, yuv_planes_t* planes);
+
+// JFIF YCbCr to RGB with the fixed point constants of libjpeg, the same arithmetic its decoder uses when fancy
+// upsampling is off
+static inline void yuv_pixel_to_rgb(int y, int cb, int cr, uint8_t* red, uint8_t* green, uint8_t* blue)
+{
+    cb -= 128;
+    cr -= 128;
+    int r = y + ((91881 * cr + 32768) >> 16);
+    int g = y + ((-22554 * cb - 46802 * cr + 32768) >> 16);
+    int b = y + ((116130 * cb + 32768) >> 16);
+    *red = (uint8_t)(r < 0 ? 0 : (r > 255 ? 255 : r));
+    *green = (uint8_t)(g < 0 ? 0 : (g > 255 ? 255 : g));
+    *blue = (uint8_t)(b < 0 ? 0 : (b > 255 ? 255 : b));
+}
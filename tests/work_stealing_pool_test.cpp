@@ -0,0 +1,146 @@
+// Copyright(c) Microsoft Corporation.All rights reserved.
+// Licensed under the MIT License.
+
+// Stress test of work_stealing_pool: every task runs exactly once, no two tasks of a loop share a slot at once, and
+// loops started concurrently from several threads or nested inside tasks all complete. Exits with 0 on success.
+// Besides the tests project, it builds on its own, which is the way to run it under ThreadSanitizer:
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -I../rgbd_kinect work_stealing_pool_test.cpp
+//       ../rgbd_kinect/work_stealing_pool.cpp -lpthread
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "work_stealing_pool.h"
+
+static std::atomic<size_t> failure_count{ 0 };
+
+static void check(bool condition, const char* what, size_t task_count)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s (%zu tasks)\n", what, task_count);
+        failure_count++;
+    }
+}
+
+// Runs one loop of task_count tasks and checks that each ran exactly once and that slots were never shared. Uneven
+// task times make the threads run out of their own range at different times, so most loops end up stealing.
+static void run_checked_loop(work_stealing_pool* pool, size_t task_count, size_t nested_task_count)
+{
+    std::unique_ptr<std::atomic<int>[]> runs(new std::atomic<int>[task_count + 1]);
+    std::unique_ptr<std::atomic<int>[]> slot_users(new std::atomic<int>[pool->slot_count()]);
+    for (size_t t = 0; t < task_count; t++)
+    {
+        runs[t] = 0;
+    }
+    for (size_t s = 0; s < pool->slot_count(); s++)
+    {
+        slot_users[s] = 0;
+    }
+    std::atomic<bool> slot_shared{ false };
+    std::atomic<bool> slot_out_of_range{ false };
+
+    pool->parallel_for(task_count, [&](size_t task, size_t slot) {
+        if (slot >= pool->slot_count())
+        {
+            slot_out_of_range = true;
+            return;
+        }
+        if (slot_users[slot]++ != 0)
+        {
+            slot_shared = true;
+        }
+
+        runs[task]++;
+        if (task % 7 == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        if (nested_task_count > 0 && task % 3 == 0)
+        {
+            run_checked_loop(pool, nested_task_count, 0);
+        }
+
+        slot_users[slot]--;
+    });
+
+    bool each_once = true;
+    for (size_t t = 0; t < task_count; t++)
+    {
+        each_once = each_once && runs[t] == 1;
+    }
+    check(each_once, "every task runs exactly once", task_count);
+    check(!slot_shared, "no two tasks of a loop share a slot at once", task_count);
+    check(!slot_out_of_range, "slots are below slot_count", task_count);
+}
+
+static void test_single_loops(work_stealing_pool* pool)
+{
+    const size_t task_counts[] = { 0, 1, 2, 3, 5, 8, 17, 100, 1000 };
+    for (size_t task_count : task_counts)
+    {
+        run_checked_loop(pool, task_count, 0);
+    }
+}
+
+static void test_nested_loops(work_stealing_pool* pool)
+{
+    for (int round = 0; round < 20; round++)
+    {
+        run_checked_loop(pool, 30, 9);
+    }
+}
+
+static void test_concurrent_loops(work_stealing_pool* pool)
+{
+    std::vector<std::thread> callers;
+    for (size_t c = 0; c < 4; c++)
+    {
+        callers.push_back(std::thread([pool, c] {
+            for (int round = 0; round < 50; round++)
+            {
+                // half of the callers also nest, so nested and concurrent loops share the workers
+                run_checked_loop(pool, 20 + c * 13, c % 2 == 0 ? 0 : 5);
+            }
+        }));
+    }
+    for (std::thread& caller : callers)
+    {
+        caller.join();
+    }
+}
+
+int main()
+{
+    const size_t worker_counts[] = { 0, 1, 3, 7 };
+    for (size_t worker_count : worker_counts)
+    {
+        work_stealing_pool pool(worker_count);
+        test_single_loops(&pool);
+        test_nested_loops(&pool);
+        test_concurrent_loops(&pool);
+        printf("%zu workers done\n", worker_count);
+    }
+
+    // a pool destroyed right after it was created, or after one loop, must shut its workers down cleanly
+    for (int round = 0; round < 20; round++)
+    {
+        work_stealing_pool pool(3);
+        if (round % 2 == 0)
+        {
+            run_checked_loop(&pool, 10, 0);
+        }
+    }
+
+    if (failure_count > 0)
+    {
+        printf("%zu checks failed\n", failure_count.load());
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}